@@ -0,0 +1,153 @@
+/*
+ * Cost of an edit with `parser_edit()` against parsing the whole file
+ * again. The edits land in random function bodies and alternate
+ * between renaming an identifier in place and inserting a statement,
+ * which moves everything after it. With -c, every `check` edits and
+ * after the last one the AST is compared with a parse of the edited
+ * text from scratch.
+ *
+ * usage: edit [-n edits] [-r seed] [-c check] file
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "lexer.h"
+#include "parser.h"
+
+#define STATEMENT "\tbench = bench + 1;\n"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Start of a random line inside a function body. */
+static usize body_line(char *s, usize size)
+{
+	for (;;) {
+		usize i = (usize)rand() % size;
+		while (i > 0 && s[i - 1] != '\n') i--;
+		if (s[i] == '\t') return i;
+	}
+}
+
+/* First name on the line at `i` that is not a keyword, 0 if none. */
+static usize find_name(char *s, usize i)
+{
+	while (s[i] != '\n') {
+		usize j = i;
+		while (isalnum((u8)s[j]) || s[j] == '_') j++;
+		if (j - i > 1 && isalpha((u8)s[i]) && lexer_keyword(s + i, j - i) == TOKEN_IDENTIFIER) {
+			return i;
+		}
+		i = j > i ? j : i + 1;
+	}
+	return 0;
+}
+
+/* Whether the AST of `p` is the one a full parse of `text` gives. */
+static bool reparse_equal(parser *p, char *text, usize size)
+{
+	arena a = arena_init(0x1000 * 0x1000 * 64);
+	lexer *l = lexer_init(text, size, &a);
+	parser *q = parser_init(l, &a);
+	bool equal = !arrlen(q->diagnostics) && ast_equal(p->ast, p->root, q->ast, q->root)
+		&& arrlen(p->ast->bases) == arrlen(q->ast->bases)
+		&& memcmp(p->ast->bases, q->ast->bases, arrlen(q->ast->bases) * sizeof(u32)) == 0;
+	parser_deinit(q);
+	lexer_deinit(l);
+	arena_deinit(a);
+	return equal;
+}
+
+int main(int argc, char **argv)
+{
+	long edits = 1000;
+	unsigned seed = 1;
+	long check = 0;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			edits = strtol(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			check = strtol(argv[++i], NULL, 10);
+		} else {
+			break;
+		}
+	}
+	if (i + 1 != argc || edits < 1 || check < 0) {
+		fprintf(stderr, "usage: edit [-n edits] [-r seed] [-c check] file\n");
+		return 1;
+	}
+
+	source_file src = source_open(argv[i]);
+	if (!src.data) {
+		fprintf(stderr, "edit: can't open `%s`.\n", argv[i]);
+		return 1;
+	}
+	usize size = src.size;
+	char *text = malloc(size + edits * sizeof(STATEMENT));
+	memcpy(text, src.data, size);
+	source_close(src);
+
+	arena a = arena_init(0x1000 * 0x1000 * 64);
+	double start = now();
+	lexer *l = lexer_init(text, size, &a);
+	parser *p = parser_init(l, &a);
+	double full = now() - start;
+
+	srand(seed);
+	/* Renames, then insertions. */
+	double total[2] = { 0 };
+	long count[2] = { 0 };
+	for (long e = 0; e < edits; e++) {
+		usize at = body_line(text, size);
+		u32 end = at, len;
+		usize name = e % 2 == 0 ? find_name(text, at) : 0;
+		if (name) {
+			/* Change a letter of the name, it can't turn into a keyword. */
+			at = name + 1;
+			text[at] = text[at] == 'x' ? 'y' : 'x';
+			end = at + 1;
+			len = 1;
+		} else {
+			len = sizeof(STATEMENT) - 1;
+			memmove(text + at + len, text + at, size - at);
+			memcpy(text + at, STATEMENT, len);
+		}
+		size += len - (end - at);
+
+		start = now();
+		parser_edit(p, text, size, at, end, len);
+		total[!name] += now() - start;
+		count[!name] += 1;
+
+		if (check && ((e + 1) % check == 0 || e + 1 == edits)
+				&& !reparse_equal(p, text, size)) {
+			fprintf(stderr, "edit: edit %ld at %zu differs from a full parse.\n", e + 1, at);
+			return 1;
+		}
+	}
+
+	printf("%s: full parse %.2f ms\n", argv[i], full * 1e3);
+	char *kinds[] = { "rename", "insert" };
+	for (int k = 0; k < 2; k++) {
+		if (!count[k]) continue;
+		double mean = total[k] / count[k];
+		printf("%-8s %6ld edits %10.2f us each (%.0fx)\n", kinds[k], count[k], mean * 1e6, full / mean);
+	}
+	if (check) printf("checked against a full parse every %ld edits\n", check);
+
+	parser_deinit(p);
+	lexer_deinit(l);
+	arena_deinit(a);
+	free(text);
+	return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Generate a synthetic L corpus for the lexer benchmarks. Every shape
+ * is made of functions full of statements, what changes is which kind
+ * of token dominates:
+ *
+ *   mixed    a bit of everything, close to hand written code
+ *   ident    long declarations and calls, mostly identifiers
+ *   op       arithmetic and bitwise expressions, mostly operators
+ *   literal  numbers of every base, floats, strings and characters
+ *   comment  code interleaved with line comments
+ *
+ * usage: gen [-t shape] [-s megabytes] [-r seed] > file.l
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NNAMES 4096
+
+enum { MIXED, IDENT, OP, LITERAL, COMMENT };
+
+static char *shapes[] = { "mixed", "ident", "op", "literal", "comment" };
+
+static char *syllables[] = {
+	"buf", "len", "node", "count", "idx", "ptr", "val", "next", "data", "size",
+	"tmp", "res", "key", "map", "list", "str", "pos", "end", "cur", "item",
+};
+
+static char *types[] = { "u8", "u16", "u32", "u64", "i32", "i64", "f32", "f64" };
+
+static char *binary[] = {
+	"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>", "==", "!=", "<",
+	">", "<=", ">=", "&&", "||",
+};
+
+static char *assign[] = { "=", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>=" };
+
+static char *words[] = {
+	"the", "value", "is", "clamped", "before", "use", "see", "above", "we",
+	"never", "free", "this", "buffer", "here", "fast", "path", "for", "small",
+};
+
+#define LEN(a) (sizeof(a) / sizeof(*(a)))
+
+static char names[NNAMES][32];
+static unsigned long written;
+
+static unsigned long rnd(unsigned long n)
+{
+	return (unsigned long)rand() % n;
+}
+
+static void emit(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vprintf(fmt, ap);
+	va_end(ap);
+	if (n > 0) written += n;
+}
+
+/* Identifiers follow a rough power law: a few are everywhere. */
+static char *name(void)
+{
+	unsigned long r = rnd(NNAMES);
+	return names[r * r / NNAMES * r / NNAMES];
+}
+
+static char *type(void)
+{
+	return types[rnd(LEN(types))];
+}
+
+static void literal(void)
+{
+	switch (rnd(7)) {
+	case 0: emit("%lu", rnd(100000)); break;
+	case 1: emit("0x%lx_%04lx", rnd(0x10000), rnd(0x10000)); break;
+	case 2: emit("0b%lu%lu%lu%lu_%lu%lu%lu%lu", rnd(2), rnd(2), rnd(2), rnd(2), rnd(2), rnd(2), rnd(2), rnd(2)); break;
+	case 3: emit("0o%lo", rnd(01000)); break;
+	case 4: emit("%lu.%lu", rnd(1000), rnd(1000000)); break;
+	case 5: emit("%lu.%lue-%lu", rnd(10), rnd(100000), rnd(300)); break;
+	case 6: emit("1_000_%03lu", rnd(1000)); break;
+	}
+}
+
+static void operand(int shape)
+{
+	if (shape == LITERAL || (shape != IDENT && rnd(4) == 0)) {
+		literal();
+	} else {
+		emit("%s", name());
+	}
+}
+
+static void expression(int shape, int depth)
+{
+	unsigned long terms = shape == OP ? 3 + rnd(6) : 1 + rnd(3);
+	if (shape == OP && depth < 2 && rnd(3) == 0) {
+		emit("(");
+		expression(shape, depth + 1);
+		emit(")");
+	} else {
+		operand(shape);
+	}
+	for (unsigned long i=1; i < terms; i++) {
+		emit(" %s ", binary[rnd(LEN(binary))]);
+		operand(shape);
+	}
+}
+
+static void comment(void)
+{
+	emit("\t//");
+	for (unsigned long i = 3 + rnd(10); i > 0; i--) {
+		emit(" %s", words[rnd(LEN(words))]);
+	}
+	emit("\n");
+}
+
+static void statement(int shape)
+{
+	if (shape == COMMENT && rnd(2) == 0) {
+		comment();
+		return;
+	}
+
+	switch (shape == LITERAL ? rnd(3) : rnd(6)) {
+	case 0:
+		emit("\t%s %s = ", type(), name());
+		expression(shape, 0);
+		emit(";\n");
+		break;
+	case 1:
+		emit("\t[u8] %s = \"%s %s %s\";\n", name(), words[rnd(LEN(words))], words[rnd(LEN(words))], words[rnd(LEN(words))]);
+		break;
+	case 2:
+		emit("\tu8 %s = '%c';\n", name(), (int)('a' + rnd(26)));
+		break;
+	case 3:
+		emit("\t%s %s ", name(), assign[rnd(LEN(assign))]);
+		expression(shape, 0);
+		emit(";\n");
+		break;
+	case 4:
+		emit("\t%s(", name());
+		for (unsigned long i = rnd(shape == IDENT ? 6 : 3); i > 0; i--) {
+			operand(shape);
+			emit(i > 1 ? ", " : "");
+		}
+		emit(");\n");
+		break;
+	case 5:
+		emit("\tif %s < %s {\n\t\t%s++;\n\t}\n", name(), name(), name());
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int shape = MIXED;
+	unsigned long size = 16;
+	unsigned seed = 1;
+
+	for (int i=1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			char *t = argv[++i];
+			for (shape = LEN(shapes) - 1; shape >= 0 && strcmp(shapes[shape], t); shape--);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			size = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			seed = strtoul(argv[++i], NULL, 10);
+		} else {
+			shape = -1;
+		}
+	}
+	if (shape < 0) {
+		fprintf(stderr, "usage: gen [-t mixed|ident|op|literal|comment] [-s megabytes] [-r seed]\n");
+		return 1;
+	}
+
+	srand(seed);
+	for (int i=0; i < NNAMES; i++) {
+		snprintf(names[i], sizeof(names[i]), "%s_%s%d", syllables[rnd(LEN(syllables))],
+				syllables[rnd(LEN(syllables))], i);
+	}
+
+	size <<= 20;
+	for (unsigned long f=0; written < size; f++) {
+		emit("%s f%lu(%s %s, %s %s)\n{\n", type(), f, type(), name(), type(), name());
+		for (unsigned long i = 4 + rnd(20); i > 0; i--) {
+			statement(shape);
+		}
+		emit("\treturn %s;\n}\n\n", name());
+	}
+
+	return 0;
+}
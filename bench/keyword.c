@@ -0,0 +1,93 @@
+/*
+ * Microbenchmark of keyword recognition: the keyword perfect hash used
+ * by the lexer against the 256-way trie it replaced.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "lexer.h"
+
+#define ROUNDS 2000
+
+static char *keywords[] = {
+	"true", "false", "struct", "enum", "union", "loop", "while", "until",
+	"goto", "if", "else", "switch", "break", "defer", "return", "import",
+	"const", "extern", "volatile",
+};
+
+static token_type keyword_types[] = {
+	TOKEN_TRUE, TOKEN_FALSE, TOKEN_STRUCT, TOKEN_ENUM, TOKEN_UNION,
+	TOKEN_LOOP, TOKEN_WHILE, TOKEN_UNTIL, TOKEN_GOTO, TOKEN_IF, TOKEN_ELSE,
+	TOKEN_SWITCH, TOKEN_BREAK, TOKEN_DEFER, TOKEN_RETURN, TOKEN_IMPORT,
+	TOKEN_CONST, TOKEN_EXTERN, TOKEN_VOLATILE,
+};
+
+/* A mix of keywords and the kind of identifiers found in real code. */
+static char *words[] = {
+	"u32", "x", "return", "count", "if", "data", "i", "struct", "len",
+	"buffer", "while", "ptr", "node", "else", "result", "loop", "index",
+	"true", "value", "retur", "structs", "e", "size", "break", "const",
+	"next", "volatile", "u8", "import", "tmp", "defer", "parse_number",
+};
+
+#define NWORDS (sizeof(words) / sizeof(*words))
+
+static double elapsed(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+	arena a = arena_init(0x1000 * 0x100);
+	trie_node *root = arena_alloc(&a, sizeof(trie_node));
+	memset(root, 0x0, sizeof(trie_node));
+	for (usize i=0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+		trie_insert(root, &a, keywords[i], keyword_types[i]);
+	}
+
+	/* Two keywords sharing a slot would lose one of them. */
+	for (usize i=0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+		if (lexer_keyword(keywords[i], strlen(keywords[i])) != keyword_types[i]) {
+			printf("keyword `%s` is not recognized\n", keywords[i]);
+			return 1;
+		}
+	}
+
+	usize lens[NWORDS];
+	for (usize i=0; i < NWORDS; i++) {
+		lens[i] = strlen(words[i]);
+		token_type t = trie_get(root, words[i], lens[i]);
+		if (!t) t = TOKEN_IDENTIFIER;
+		if (lexer_keyword(words[i], lens[i]) != t) {
+			printf("mismatch on `%s`\n", words[i]);
+			return 1;
+		}
+	}
+
+	usize lookups = (usize)ROUNDS * 1000 * NWORDS;
+	volatile usize sink = 0;
+
+	clock_t start = clock();
+	for (usize r=0; r < ROUNDS * 1000; r++) {
+		for (usize i=0; i < NWORDS; i++) {
+			sink += trie_get(root, words[i], lens[i]);
+		}
+	}
+	double trie_time = elapsed(start);
+
+	start = clock();
+	for (usize r=0; r < ROUNDS * 1000; r++) {
+		for (usize i=0; i < NWORDS; i++) {
+			sink += lexer_keyword(words[i], lens[i]);
+		}
+	}
+	double hash_time = elapsed(start);
+
+	printf("trie_get:      %8.2f ns/lookup (%lu bytes of nodes)\n", trie_time * 1e9 / lookups, a.position);
+	printf("lexer_keyword: %8.2f ns/lookup\n", hash_time * 1e9 / lookups);
+
+	arena_deinit(a);
+	return 0;
+}
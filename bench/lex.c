@@ -0,0 +1,73 @@
+/*
+ * Lexer throughput on whole files: each file is lexed with
+ * `lexer_init()` (or `lexer_parallel()` with -j) a number of times,
+ * and the best and the mean run are reported in MB/s and tokens/s.
+ *
+ * usage: lex [-n rounds] [-j threads] file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "lexer.h"
+
+/* Wall clock, so that parallel lexing isn't charged for every thread. */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	long rounds = 5;
+	long threads = -1;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			rounds = strtol(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = strtol(argv[++i], NULL, 10);
+		} else {
+			break;
+		}
+	}
+	if (i == argc || rounds < 1) {
+		fprintf(stderr, "usage: lex [-n rounds] [-j threads] file...\n");
+		return 1;
+	}
+
+	printf("%-24s %10s %10s %10s %10s\n", "file", "MB", "Mtokens", "best MB/s", "mean MB/s");
+	for (; i < argc; i++) {
+		source_file src = source_open(argv[i]);
+		if (!src.data) {
+			fprintf(stderr, "lex: can't open `%s`.\n", argv[i]);
+			return 1;
+		}
+
+		usize tokens = 0;
+		double best = 0, total = 0;
+		for (long r=0; r < rounds; r++) {
+			arena a = arena_init(0x1000 * 0x1000 * 16);
+			double start = now();
+			lexer *l = threads < 0 ? lexer_init(src.data, src.size, &a)
+				: lexer_parallel(src.data, src.size, &a, threads);
+			double t = now() - start;
+			tokens = l->tokens.len;
+			lexer_deinit(l);
+			arena_deinit(a);
+
+			if (r == 0 || t < best) best = t;
+			total += t;
+		}
+
+		double mb = src.size / 1e6;
+		printf("%-24s %10.2f %10.2f %10.2f %10.2f  (%.2f Mtokens/s)\n", argv[i], mb,
+				tokens / 1e6, mb / best, mb * rounds / total, tokens / 1e6 / best);
+		source_close(src);
+	}
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Throughput of the lexer on operator-dense code: expressions made of
+ * short identifiers and every operator the language has.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "lexer.h"
+
+#define SIZE (16 << 20)
+#define ROUNDS 5
+
+static char *operators[] = {
+	"+", "++", "+=", "-", "--", "-=", "->", "/", "/=", "*", "*=", "%",
+	"%=", "&", "&=", "&&", "^", "^=", "|", "|=", "||", "=", "==", ">",
+	">=", ">>", ">>=", "<", "<=", "<<", "<<=", "!", "!=", ":", ",", ".",
+	"..", "(", ")", "[", "]", "{", "}",
+};
+
+#define NOPERATORS (sizeof(operators) / sizeof(*operators))
+
+static double elapsed(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+	/* One extra byte for the `\0` the lexer expects at the end. */
+	char *source = malloc(SIZE + 1);
+	usize len = 0;
+	srand(1);
+	while (len + 64 < SIZE) {
+		for (usize i=0; i < 8; i++) {
+			char *op = operators[rand() % NOPERATORS];
+			len += sprintf(source + len, "%c%s", 'a' + rand() % 26, op);
+		}
+		len += sprintf(source + len, "x;\n");
+	}
+	source[len] = '\0';
+
+	usize tokens = 0;
+	double best = 0;
+	for (usize r=0; r < ROUNDS; r++) {
+		arena a = arena_init(0x1000 * 0x1000);
+		clock_t start = clock();
+		lexer *l = lexer_init(source, len, &a);
+		double t = elapsed(start);
+		if (r == 0 || t < best) best = t;
+		tokens = l->tokens.len;
+		lexer_deinit(l);
+		arena_deinit(a);
+	}
+
+	printf("%lu bytes, %lu tokens\n", len, tokens);
+	printf("lexer_init: %8.2f MB/s %8.2f ns/token\n", len / best / 1e6, best * 1e9 / tokens);
+
+	free(source);
+	return 0;
+}
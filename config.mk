@@ -12,12 +12,16 @@ MANPREFIX = ${PREFIX}/share/man
 
 # includes and libs
 INCS = -I.
-LIBS =
+LIBS = -lpthread
 # flags
-CPPFLAGS = -DVERSION=\"${VERSION}\" 
-CFLAGS  := -std=c99 -pedantic -Wall -O0 ${INCS} ${CPPFLAGS} 
+CPPFLAGS = -D_DEFAULT_SOURCE -D_POSIX_C_SOURCE=200809L -DVERSION=\"${VERSION}\"
+CFLAGS  := -std=c99 -pedantic -Wall -Woverride-init -O0 ${INCS} ${CPPFLAGS} 
 CFLAGS  := ${CFLAGS} -g
 LDFLAGS  = ${LIBS}
+# benchmarks are always built with optimizations
+BENCHFLAGS = -std=c99 -pedantic -Wall -Woverride-init -O2 ${INCS} ${CPPFLAGS}
+# size in megabytes of the generated lexer corpora
+BENCHSIZE = 32
 
 # Solaris
 #CFLAGS = -fast ${INCS} -DVERSION=\"${VERSION}\"
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "utils.h"
 #include "lexer.h"
 #include "parser.h"
@@ -27,11 +28,19 @@ const char* get_op_str(binary_op op) {
 		case OP_BOR: return "|";
 		case OP_BAND: return "&";
 		case OP_BXOR: return "^";
+		case OP_LSHIFT: return "<<";
+		case OP_RSHIFT: return ">>";
 		case OP_MOD: return "%";
 		case OP_PLUS_EQ: return "+=";
 		case OP_MINUS_EQ: return "-=";
 		case OP_DIV_EQ: return "/=";
 		case OP_MUL_EQ: return "*=";
+		case OP_MOD_EQ: return "%=";
+		case OP_BOR_EQ: return "|=";
+		case OP_BAND_EQ: return "&=";
+		case OP_BXOR_EQ: return "^=";
+		case OP_LSHIFT_EQ: return "<<=";
+		case OP_RSHIFT_EQ: return ">>=";
 		default: return "?";
 	}
 }
@@ -48,190 +57,254 @@ const char *get_uop_str(unary_op op) {
 	}
 }
 
-void print_ast(ast_node *node, int depth) {
+void print_name(ast *a, u32 symbol) {
+	printf("%.*s\n", (int)symbol_len(a->symbols, symbol), symbol_name(a->symbols, symbol));
+}
+
+void print_ast(ast *a, node_id node, int depth);
+
+/* Offset of the declaration being printed, node offsets are relative to it. */
+static u32 base;
+
+void print_list(ast *a, u32 start, u32 len, int depth) {
+	for (u32 i = 0; i < len; i++) print_ast(a, a->children[start + i], depth);
+}
+
+void print_ast(ast *a, node_id node, int depth) {
 	if (!node) return;
 
 	print_indent(depth);
 
-	switch (node->type) {
+	u32 data = a->data[node];
+	u32 m;
+	switch (a->kinds[node]) {
 		case NODE_INTEGER:
-			printf("Integer: %lu\n", node->expr.integer);
+			printf("Integer: %lu\n", a->integers[data]);
 			break;
 		case NODE_FLOAT:
-			printf("Float: %f\n", node->expr.flt);
+			printf("Float: %f\n", a->floats[data]);
 			break;
 		case NODE_CHAR:
-			printf("Char: '%c'\n", node->expr.ch);
+			printf("Char: '%c'\n", (char)data);
 			break;
 		case NODE_STRING:
-			printf("String: \"%.*s\"\n", (int)node->expr.string.len, node->expr.string.start);
+			printf("String: \"%.*s\"\n", (int)data, a->source + base + a->offsets[node]);
 			break;
 		case NODE_IDENTIFIER:
-			printf("Identifier: %.*s\n", (int)node->expr.string.len, node->expr.string.start);
+			printf("Identifier: ");
+			print_name(a, data);
 			break;
 		case NODE_CAST:
 			printf("Cast:\n");
-			print_ast(node->expr.cast.type, depth);
-			print_ast(node->expr.cast.value, depth + 1);
+			print_ast(a, a->binaries[data].right, depth);
+			print_ast(a, a->binaries[data].left, depth + 1);
 			break;
 		case NODE_ACCESS:
 			printf("Access:\n");
-			print_ast(node->expr.access.expr, depth + 1);
-			print_ast(node->expr.access.member, depth + 1);
+			print_ast(a, a->binaries[data].left, depth + 1);
+			print_ast(a, a->binaries[data].right, depth + 1);
 			break;
 		case NODE_LABEL:
-			printf("Label: %.*s\n", (int)node->expr.label.name_len, node->expr.label.name);
+			printf("Label: ");
+			print_name(a, data);
 			break;
 		case NODE_GOTO:
-			printf("Goto: %.*s\n", (int)node->expr.label.name_len, node->expr.label.name);
+			printf("Goto: ");
+			print_name(a, data);
 			break;
 		case NODE_BINARY:
-			printf("BinaryOp (%s)\n", get_op_str(node->expr.binary.operator));
-			print_ast(node->expr.binary.left, depth + 1);
-			print_ast(node->expr.binary.right, depth + 1);
+			printf("BinaryOp (%s)\n", get_op_str(a->binaries[data].op));
+			print_ast(a, a->binaries[data].left, depth + 1);
+			print_ast(a, a->binaries[data].right, depth + 1);
 			break;
 		case NODE_ARRAY_SUBSCRIPT:
 			printf("Array subscript\n");
-			print_ast(node->expr.subscript.expr, depth + 1);
-			print_ast(node->expr.subscript.index, depth + 1);
+			print_ast(a, a->binaries[data].left, depth + 1);
+			print_ast(a, a->binaries[data].right, depth + 1);
 			break;
 		case NODE_UNARY:
-			printf("UnaryOp (%s)\n", get_uop_str(node->expr.unary.operator));
-			print_ast(node->expr.unary.right, depth + 1);
+			printf("UnaryOp (%s)\n", get_uop_str(a->unaries[data].op));
+			print_ast(a, a->unaries[data].operand, depth + 1);
 			break;
 		case NODE_POSTFIX:
-			printf("Postfix (%s)\n", get_uop_str(node->expr.unary.operator));
-			print_ast(node->expr.unary.right, depth + 1);
+			printf("Postfix (%s)\n", get_uop_str(a->unaries[data].op));
+			print_ast(a, a->unaries[data].operand, depth + 1);
 			break;
 		case NODE_BREAK:
 			printf("Break\n");
 			break;
-		case NODE_TERNARY:
-			printf("Ternary (? :)\n");
-			print_indent(depth + 1); printf("Condition:\n");
-			print_ast(node->expr.ternary.condition, depth + 2);
-			print_indent(depth + 1); printf("Then:\n");
-			print_ast(node->expr.ternary.then, depth + 2);
-			print_indent(depth + 1); printf("Else:\n");
-			print_ast(node->expr.ternary.otherwise, depth + 2);
-			break;
 		case NODE_UNIT:
 			printf("Unit\n");
-			ast_node *current = node;
-			while (current && current->type == NODE_UNIT) {
-				print_ast(current->expr.unit_node.expr, depth + 1);
-				current = current->expr.unit_node.next;
-			}
+			print_list(a, a->lists[data].start, a->lists[data].len, depth + 1);
 			break;
 		case NODE_CALL:
-			printf("Call: %.*s\n", (int)node->expr.call.name_len, node->expr.call.name);
-			current = node->expr.call.parameters;
-			while (current && current->type == NODE_UNIT) {
-				print_ast(current->expr.unit_node.expr, depth + 1);
-				current = current->expr.unit_node.next;
-			}
+			printf("Call: ");
+			print_name(a, a->calls[data].symbol);
+			print_list(a, a->calls[data].args, a->calls[data].argc, depth + 1);
 			break;
 		case NODE_STRUCT_INIT:
 			printf("Struct init:\n");
-			current = node->expr.struct_init.members;
-			while (current && current->type == NODE_UNIT) {
-				print_ast(current->expr.unit_node.expr, depth + 1);
-				current = current->expr.unit_node.next;
-			}
+			print_list(a, a->lists[data].start, a->lists[data].len, depth + 1);
 			break;
 		case NODE_STRUCT:
-			printf("Struct: %.*s\n", (int)node->expr.structure.name_len, node->expr.structure.name);
-			member *m = node->expr.structure.members;
-			while (m) {
-				print_ast(m->type, depth + 1);
-				m = m->next;
-			}
-			break;
 		case NODE_UNION:
-			printf("Union: %.*s\n", (int)node->expr.structure.name_len, node->expr.structure.name);
-			m = node->expr.structure.members;
-			while (m) {
-				print_ast(m->type, depth + 1);
-				m = m->next;
+			printf(a->kinds[node] == NODE_STRUCT ? "Struct: " : "Union: ");
+			print_name(a, a->aggregates[data].symbol);
+			for (m = a->aggregates[data].first; m; m = a->members[m].next) {
+				print_ast(a, a->members[m].type, depth + 1);
 			}
 			break;
 		case NODE_ENUM:
-			printf("Enum: %.*s\n", (int)node->expr.enm.name_len, node->expr.enm.name);
-			variant *v = node->expr.enm.variants;
-			while (v) {
-				printf("\t%.*s\n", (int)v->name_len, v->name);
-				v = v->next;
+			printf("Enum: ");
+			print_name(a, a->aggregates[data].symbol);
+			for (m = a->aggregates[data].first; m; m = a->variants[m].next) {
+				printf("\t");
+				print_name(a, a->variants[m].symbol);
 			}
 			break;
 		case NODE_IF:
 			printf("If:\n");
-			print_ast(node->expr.whle.condition, depth + 1);
-			print_ast(node->expr.whle.body, depth + 1);
+			print_ast(a, a->loops[data].condition, depth + 1);
+			print_ast(a, a->loops[data].body, depth + 1);
 			break;
 		case NODE_VAR_DECL:
 			printf("VarDecl: ");
-			print_ast(node->expr.var_decl.type, 0);
-			print_ast(node->expr.var_decl.value, depth + 1);
+			print_ast(a, a->decls[data].type, 0);
+			print_ast(a, a->decls[data].value, depth + 1);
 			break;
 		case NODE_FUNCTION:
-			printf("Function: %.*s\n", (int)node->expr.function.name_len, node->expr.function.name);
-			m = node->expr.function.parameters;
-			while (m) {
-				print_ast(m->type, depth + 1);
-				m = m->next;
+			printf("Function: ");
+			print_name(a, a->functions[data].symbol);
+			for (m = a->functions[data].params; m; m = a->members[m].next) {
+				print_ast(a, a->members[m].type, depth + 1);
 			}
-			print_ast(node->expr.function.body, depth + 1);
+			print_ast(a, a->functions[data].body, depth + 1);
 			break;
 		case NODE_RETURN:
 			printf("Return:\n");
-			print_ast(node->expr.ret.value, depth + 1);
+			print_ast(a, data, depth + 1);
 			break;
 		case NODE_IMPORT:
 			printf("Import:\n");
-			print_ast(node->expr.import.path, depth + 1);
+			print_ast(a, data, depth + 1);
 			break;
 		case NODE_WHILE:
 			printf("While:\n");
-			print_ast(node->expr.whle.condition, depth + 1);
-			print_ast(node->expr.whle.body, depth + 1);
+			print_ast(a, a->loops[data].condition, depth + 1);
+			print_ast(a, a->loops[data].body, depth + 1);
 			break;
 		case NODE_FOR:
 			printf("For:\n");
-			print_ast(node->expr.fr.slices, depth + 1);
-			print_ast(node->expr.fr.captures, depth + 1);
 			print_indent(depth + 1);
-			print_ast(node->expr.fr.body, depth + 1);
+			printf("Unit\n");
+			print_list(a, a->fors[data].slices, a->fors[data].slice_len, depth + 2);
+			print_indent(depth + 1);
+			printf("Unit\n");
+			print_list(a, a->fors[data].captures, a->fors[data].capture_len, depth + 2);
+			print_indent(depth + 1);
+			print_ast(a, a->fors[data].body, depth + 1);
 			break;
 		case NODE_RANGE:
 			printf("Range:\n");
-			print_ast(node->expr.binary.left, depth + 1);
-			print_ast(node->expr.binary.right, depth + 1);
+			print_ast(a, a->binaries[data].left, depth + 1);
+			print_ast(a, a->binaries[data].right, depth + 1);
 			break;
 		default:
-			printf("Unknown Node Type: %d\n", node->type);
+			printf("Unknown Node Type: %d\n", a->kinds[node]);
 			break;
 	}
 }
 
-int main(void)
+/* The root, with the base of every declaration. */
+static void print_unit(ast *a, node_id root)
 {
-	FILE *fp = fopen("examples/hello_world.l", "r");
-	usize size = 0;
-	fseek(fp, 0, SEEK_END);
-	size = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-	char *src = malloc(size+1);
-	fread(src, size, 1, fp);
-	fclose(fp);
-	src[size] = '\0';
+	ast_list unit = a->lists[a->data[root]];
+	printf("Unit\n");
+	for (u32 i = 0; i < unit.len; i++) {
+		base = a->bases[i];
+		print_ast(a, a->children[unit.start + i], 1);
+	}
+}
+
+static void report(lexer *l, diagnostic *diagnostics)
+{
+	for (usize i = 0; i < arrlen(diagnostics); i++) {
+		source_pos pos = lexer_locate(l, diagnostics[i].offset);
+		printf("\x1b[31m\x1b[1merror\x1b[0m\x1b[1m:%ld:%ld:\x1b[0m %s\n", pos.row, pos.column,
+				diagnostics[i].message);
+	}
+	printf("Compilation failed.\n");
+}
+
+int main(int argc, char **argv)
+{
+	/* With -j the source is lexed, parsed and checked on that many threads (0 for all). */
+	long jobs = -1;
+	/* The AST can be kept in `file.ast` between runs. */
+	bool emit_cache = false, use_cache = false;
+	char *path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			jobs = strtol(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--emit-ast-cache") == 0) {
+			emit_cache = true;
+		} else if (strcmp(argv[i], "--use-ast-cache") == 0) {
+			use_cache = true;
+		} else if (!path) {
+			path = argv[i];
+		} else {
+			path = NULL;
+			break;
+		}
+	}
+	if (!path || jobs < -1) {
+		fprintf(stderr, "usage: lc [-j jobs] [--emit-ast-cache] [--use-ast-cache] file\n");
+		return 1;
+	}
+
+	source_file src = source_open(path);
+	if (!src.data) {
+		fprintf(stderr, "lc: can't open `%s`.\n", path);
+		return 1;
+	}
+
+	usize len = strlen(path);
+	char *cache = malloc(len + 5);
+	memcpy(cache, path, len);
+	memcpy(cache + len, ".ast", 5);
 
 	arena a = arena_init(0x1000 * 0x1000 * 64);
-	lexer *l = lexer_init(src, size, &a);
-	parser *p = parser_init(l, &a);
-	print_ast(p->ast, 0);
-	sema *s = sema_init(p, &a);
+	lexer *l = NULL;
+	parser *p = NULL;
+	if (use_cache) {
+		/* The lexer only locates errors, it never runs. */
+		l = lexer_stream(src.data, src.size, &a);
+		p = ast_load(l, cache, &a);
+		if (!p) {
+			lexer_deinit(l);
+		}
+	}
+	if (!p) {
+		l = jobs < 0 ? lexer_stream(src.data, src.size, &a)
+			: lexer_parallel(src.data, src.size, &a, jobs);
+		p = jobs < 0 ? parser_init(l, &a) : parser_parallel(l, &a, jobs);
+		if (arrlen(p->diagnostics)) {
+			report(l, p->diagnostics);
+			return 1;
+		}
+		if (emit_cache && !ast_save(p, cache)) {
+			fprintf(stderr, "lc: can't write `%s`.\n", cache);
+		}
+	}
+	print_unit(p->ast, p->root);
+	sema *s = jobs < 0 ? sema_init(p, &a) : sema_parallel(p, &a, jobs);
 
+	sema_deinit(s);
+	parser_deinit(p);
+	lexer_deinit(l);
 	arena_deinit(a);
+	source_close(src);
+	free(cache);
 
 	return 0;
 }
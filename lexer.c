@@ -1,422 +1,680 @@
 #include "lexer.h"
+#include "scan.h"
 #include <stdbool.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
-trie_node *keywords;
+/*
+ * Keywords are recognized with a perfect hash over the length, the first
+ * and the last character of the lexeme. The slots of the table are
+ * computed by the compiler with the same macro used by the lookup: a
+ * collision between two keywords overrides a slot, which config.mk makes
+ * a warning with -Woverride-init, and bench/keyword fails on.
+ */
+#define KEYWORD_HASH(len, first, last) (((len) * 2 + (first) * 13 + (last)) & 31)
+#define KEYWORD(word, first, last, type) \
+	[KEYWORD_HASH(sizeof(word) - 1, first, last)] = { word, sizeof(word) - 1, type }
 
-static void add_token(lexer *l, token_type type, usize len)
+static const struct {
+	char *word;
+	usize len;
+	token_type type;
+} keywords[32] = {
+	KEYWORD("true", 't', 'e', TOKEN_TRUE),
+	KEYWORD("false", 'f', 'e', TOKEN_FALSE),
+	KEYWORD("struct", 's', 't', TOKEN_STRUCT),
+	KEYWORD("enum", 'e', 'm', TOKEN_ENUM),
+	KEYWORD("union", 'u', 'n', TOKEN_UNION),
+	KEYWORD("loop", 'l', 'p', TOKEN_LOOP),
+	KEYWORD("while", 'w', 'e', TOKEN_WHILE),
+	KEYWORD("until", 'u', 'l', TOKEN_UNTIL),
+	KEYWORD("goto", 'g', 'o', TOKEN_GOTO),
+	KEYWORD("if", 'i', 'f', TOKEN_IF),
+	KEYWORD("else", 'e', 'e', TOKEN_ELSE),
+	KEYWORD("switch", 's', 'h', TOKEN_SWITCH),
+	KEYWORD("break", 'b', 'k', TOKEN_BREAK),
+	KEYWORD("defer", 'd', 'r', TOKEN_DEFER),
+	KEYWORD("return", 'r', 'n', TOKEN_RETURN),
+	KEYWORD("import", 'i', 't', TOKEN_IMPORT),
+	KEYWORD("const", 'c', 't', TOKEN_CONST),
+	KEYWORD("extern", 'e', 'n', TOKEN_EXTERN),
+	KEYWORD("volatile", 'v', 'e', TOKEN_VOLATILE),
+};
+
+token_type lexer_keyword(char *s, usize len)
 {
-	token *t = arena_alloc(l->allocator, sizeof(token));
-	t->type = type;
-	t->lexeme_len = len;
-	t->lexeme = l->source + l->index;
-	t->position.row = l->row;
-	t->position.column = l->column;
+	usize slot = KEYWORD_HASH(len, (u8)s[0], (u8)s[len - 1]);
+	if (keywords[slot].len == len && memcmp(keywords[slot].word, s, len) == 0) {
+		return keywords[slot].type;
+	}
+	return TOKEN_IDENTIFIER;
+}
 
-	if (!l->tokens) {
-		l->tokens = t;
-		l->tail = t;
-	} else {
-		l->tail->next = t;
-		l->tail = t;
+enum {
+	ERROR_UNCLOSED_STRING,
+	ERROR_UNCLOSED_CHAR,
+	ERROR_MALFORMED_NUMBER,
+};
+
+static char *errors[] = {
+	[ERROR_UNCLOSED_STRING] = "unclosed string literal.",
+	[ERROR_UNCLOSED_CHAR] = "unclosed character literal.",
+	[ERROR_MALFORMED_NUMBER] = "malformed number literal.",
+};
+
+/*
+ * Move the live tokens of a column to a buffer of `capacity` slots. The
+ * window [base, len) wraps around the old and the new buffer at
+ * different points, so it is copied in at most three runs.
+ */
+static void *regrow(void *column, usize elem, token_list *t, usize capacity)
+{
+	u8 *old = column;
+	u8 *new = malloc(capacity * elem);
+	usize i = t->base;
+	while (i < t->len) {
+		usize from = i & (t->capacity - 1);
+		usize to = i & (capacity - 1);
+		usize run = t->len - i;
+		if (run > t->capacity - from) run = t->capacity - from;
+		if (run > capacity - to) run = capacity - to;
+		memcpy(new + to * elem, old + from * elem, run * elem);
+		i += run;
 	}
+	free(old);
+	return new;
 }
 
-static void add_error(lexer *l, char *msg)
+static void grow_tokens(token_list *t)
 {
-	token *t = arena_alloc(l->allocator, sizeof(token));
-	t->type = TOKEN_ERROR;
-	t->lexeme_len = strlen(msg);
-	t->lexeme = msg;
-	t->position.row = l->row;
-	t->position.column = l->column;
+	usize capacity = t->capacity ? t->capacity * 2 : 1024;
+	t->types = regrow(t->types, sizeof(*t->types), t, capacity);
+	t->offsets = regrow(t->offsets, sizeof(*t->offsets), t, capacity);
+	t->lengths = regrow(t->lengths, sizeof(*t->lengths), t, capacity);
+	t->symbols = regrow(t->symbols, sizeof(*t->symbols), t, capacity);
+	t->capacity = capacity;
+}
 
-	if (!l->tokens) {
-		l->tokens = t;
-		l->tail = t;
-	} else {
-		l->tail->next = t;
-		l->tail = t;
+/*
+ * When streaming, the tokens before the cursor will never be read again
+ * and their slots can be reused.
+ */
+static void add_token(lexer *l, token_type type, usize len)
+{
+	token_list *t = &l->tokens;
+	if (t->len - t->base == t->capacity) {
+		if (l->streaming) {
+			t->base = l->cursor;
+		}
+		if (t->len - t->base == t->capacity) {
+			grow_tokens(t);
+		}
 	}
+
+	usize i = t->len & (t->capacity - 1);
+	t->types[i] = type;
+	t->offsets[i] = l->index;
+	t->lengths[i] = len;
+	t->symbols[i] = type == TOKEN_IDENTIFIER ? intern(l->symbols, l->source + l->index, len) : 0;
+	t->len += 1;
+}
+
+static void add_error(lexer *l, u32 msg)
+{
+	add_token(l, TOKEN_ERROR, msg);
+}
+
+/* Decimal digits and `_` separators. */
+static usize scan_digits(char *s, usize i, usize end)
+{
+	while (i < end && (isdigit((u8)s[i]) || s[i] == '_')) {
+		i += 1;
+	}
+	return i;
 }
 
 static void parse_number(lexer *l)
 {
-	char c = l->source[l->index];
-	/* Is the number a float? */
-	bool f = false;
-	usize len = 0;
-
-	while (isdigit(c)) {
-		/* If a dot is found, and the character after it is a digit, this is a float. */
-		if (l->source[l->index+1] == '.' && isdigit(l->source[l->index+2])) {
-			f = true;
-			len += 3;
-			l->index += 3;
+	char *s = l->source;
+	usize i = l->index;
+
+	/*
+	 * Hex, binary and octal integers. The whole alphanumeric run is the
+	 * literal, so that `0b12` is an error rather than two numbers.
+	 */
+	if (s[i] == '0' && (s[i+1] == 'x' || s[i+1] == 'b' || s[i+1] == 'o')) {
+		char prefix = s[i+1];
+		usize end = scan.identifier(s, i + 2, l->size);
+		bool valid = false;
+		for (usize j = i + 2; j < end; j++) {
+			char c = s[j];
+			if (c == '_') continue;
+			valid = prefix == 'x' ? isxdigit((u8)c) : prefix == 'b' ? c == '0' || c == '1' : c >= '0' && c <= '7';
+			if (!valid) break;
+		}
+		if (valid) {
+			add_token(l, TOKEN_INTEGER, end - i);
 		} else {
-			len += 1;
-			l->index += 1;
+			add_error(l, ERROR_MALFORMED_NUMBER);
 		}
-		c = l->source[l->index];
+		l->index = end;
+		return;
 	}
-	l->index -= len;
-	if (f) {
-		add_token(l, TOKEN_FLOAT, len);
-	} else {
-		add_token(l, TOKEN_INTEGER, len);
+
+	token_type type = TOKEN_INTEGER;
+	i = scan_digits(s, i, l->size);
+	/* The dot must be followed by a digit, `0..10` is a range. */
+	if (s[i] == '.' && isdigit((u8)s[i+1])) {
+		type = TOKEN_FLOAT;
+		i = scan_digits(s, i + 1, l->size);
 	}
-	l->index += len;
+	if (s[i] == 'e' || s[i] == 'E') {
+		usize j = i + 1;
+		if (s[j] == '+' || s[j] == '-') j += 1;
+		if (isdigit((u8)s[j])) {
+			type = TOKEN_FLOAT;
+			i = scan_digits(s, j, l->size);
+		}
+	}
+	add_token(l, type, i - l->index);
+	l->index = i;
 }
 
 static void parse_identifier(lexer *l)
 {
-	char c = l->source[l->index];
-	usize len = 0;
-
-	while (isalnum(c) || c == '_') {
-		len += 1;
-		l->index += 1;
-		c = l->source[l->index];
-	}
-	l->index -= len;
-	token_type keyword = trie_get(keywords, l->source + l->index, len);
-	if (keyword) {
-		add_token(l, keyword, len);
-	} else {
-		add_token(l, TOKEN_IDENTIFIER, len);
-	}
+	usize len = scan.identifier(l->source, l->index + 1, l->size) - l->index;
+	add_token(l, lexer_keyword(l->source + l->index, len), len);
 	l->index += len;
 }
 
 static void parse_string(lexer *l)
 {
-	char c = l->source[l->index];
-	usize len = 0;
-
-	while (c != '"') {
-		if (c == '\0' || c == '\n') {
-			l->index -= len;
-			add_error(l, "unclosed string literal.");
-			l->index += len;
-			return;
-		}
-		len += 1;
-		l->index += 1;
-		c = l->source[l->index];
+	usize len = scan.string(l->source, l->index, l->size) - l->index;
+	if (l->source[l->index + len] != '"') {
+		add_error(l, ERROR_UNCLOSED_STRING);
+		l->index += len;
+		return;
 	}
-	l->index -= len;
 	add_token(l, TOKEN_STRING, len);
 	l->index += len + 1;
 }
 
-static bool parse_special(lexer *l)
+/*
+ * Operators are lexed with a DFA built from this list on the first
+ * call to `create()`. Bytes are first mapped to a class, so a row of
+ * the transition table only has a column for the bytes that appear in
+ * some operator, and the walk keeps the longest accepted match.
+ */
+static const struct {
+	char *spelling;
+	token_type type;
+} operators[] = {
+	{ "+", TOKEN_PLUS }, { "++", TOKEN_PLUS_PLUS }, { "+=", TOKEN_PLUS_EQ },
+	{ "-", TOKEN_MINUS }, { "--", TOKEN_MINUS_MINUS }, { "-=", TOKEN_MINUS_EQ },
+	{ "->", TOKEN_ARROW },
+	{ "/", TOKEN_SLASH }, { "/=", TOKEN_SLASH_EQ },
+	{ "*", TOKEN_STAR }, { "*=", TOKEN_STAR_EQ },
+	{ "%", TOKEN_PERC }, { "%=", TOKEN_PERC_EQ },
+	{ "&", TOKEN_AND }, { "&=", TOKEN_AND_EQ }, { "&&", TOKEN_DOUBLE_AND },
+	{ "^", TOKEN_HAT }, { "^=", TOKEN_HAT_EQ },
+	{ "|", TOKEN_PIPE }, { "|=", TOKEN_PIPE_EQ }, { "||", TOKEN_OR },
+	{ "=", TOKEN_EQ }, { "==", TOKEN_DOUBLE_EQ },
+	{ ">", TOKEN_GREATER_THAN }, { ">=", TOKEN_GREATER_EQ },
+	{ ">>", TOKEN_RSHIFT }, { ">>=", TOKEN_RSHIFT_EQ },
+	{ "<", TOKEN_LESS_THAN }, { "<=", TOKEN_LESS_EQ },
+	{ "<<", TOKEN_LSHIFT }, { "<<=", TOKEN_LSHIFT_EQ },
+	{ "!", TOKEN_BANG }, { "!=", TOKEN_NOT_EQ },
+	{ ":", TOKEN_COLON }, { ";", TOKEN_SEMICOLON }, { ",", TOKEN_COMMA },
+	{ ".", TOKEN_DOT }, { "..", TOKEN_DOUBLE_DOT },
+	{ "(", TOKEN_LPAREN }, { ")", TOKEN_RPAREN },
+	{ "[", TOKEN_LSQUARE }, { "]", TOKEN_RSQUARE },
+	{ "{", TOKEN_LCURLY }, { "}", TOKEN_RCURLY },
+};
+
+/* Enough for the list above: one state per operator plus the start. */
+#define OPERATOR_STATES 64
+#define OPERATOR_CLASSES 32
+
+/* Class 0 and state 0 (the start) are never a transition target. */
+static u8 operator_class[256];
+static u8 operator_next[OPERATOR_STATES][OPERATOR_CLASSES];
+static u8 operator_accept[OPERATOR_STATES];
+
+static void operators_init(void)
 {
-	switch (l->source[l->index]) {
-	case '+':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_PLUS_EQ, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '+') {
-			add_token(l, TOKEN_PLUS_PLUS, 2);
-			l->index += 2;
-		} else {
-			add_token(l, TOKEN_PLUS, 1);
-			l->index += 1;
+	usize classes = 1, states = 1;
+	for (usize i = 0; i < sizeof(operators) / sizeof(*operators); i++) {
+		usize state = 0;
+		for (char *c = operators[i].spelling; *c; c++) {
+			u8 *class = &operator_class[(u8)*c];
+			if (!*class) *class = classes++;
+			u8 *next = &operator_next[state][*class];
+			if (!*next) *next = states++;
+			state = *next;
 		}
-		return true;
-	case '-':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_MINUS_EQ, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '-') {
-			add_token(l, TOKEN_MINUS_MINUS, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '>') {
-			add_token(l, TOKEN_ARROW, 2);
-			l->index += 2;
-		} else {
-			add_token(l, TOKEN_MINUS, 1);
-			l->index += 1;
-		}
-		return true;
-	case '/':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_SLASH_EQ, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_SLASH, 1);
-			l->index += 1;
-		}
-		return true;
-	case '*':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_STAR_EQ, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_STAR, 1);
-			l->index += 1;
-		}
-		return true;
-	case '%':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_PERC_EQ, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_PERC, 1);
-			l->index += 1;
-		}
-		return true;
-	case '&':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_AND_EQ, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '&') {
-			add_token(l, TOKEN_DOUBLE_AND, 2);
-			l->index += 2;
-		} else {
-			add_token(l, TOKEN_AND, 1);
-			l->index += 1;
-		}
-		return true;
-	case '^':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_HAT_EQ, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_HAT, 1);
-			l->index += 1;
-		}
-		return true;
-	case '|':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_PIPE_EQ, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '|') {
-			add_token(l, TOKEN_OR, 2);
-			l->index += 2;
-		} else {
-			add_token(l, TOKEN_PIPE, 1);
-			l->index += 1;
-		}
-		return true;
-	case '=':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_DOUBLE_EQ, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_EQ, 1);
-			l->index += 1;
-		}
-		return true;
-	case '>':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_GREATER_EQ, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '>') {
-			if (l->source[l->index+2] == '=') {
-				add_token(l, TOKEN_RSHIFT_EQ, 3);
-				l->index += 3;
-				return true;
-			}
-			add_token(l, TOKEN_RSHIFT, 2);
-			l->index += 2;
-		} else {
-			add_token(l, TOKEN_GREATER_THAN, 1);
-			l->index += 1;
-		}
-		return true;
-	case '<':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_LESS_EQ, 2);
-			l->index += 2;
-		} else if (l->source[l->index+1] == '<') {
-			if (l->source[l->index+2] == '=') {
-				add_token(l, TOKEN_LSHIFT_EQ, 3);
-				l->index += 3;
-				return true;
-			}
-			add_token(l, TOKEN_LSHIFT, 2);
-			l->index += 2;
-		} else {
-			add_token(l, TOKEN_LESS_THAN, 1);
-			l->index += 1;
-		}
-		return true;
-	case '!':
-		if (l->source[l->index+1] == '=') {
-			add_token(l, TOKEN_NOT_EQ, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_BANG, 1);
-			l->index += 1;
-		}
-		return true;
-	case ':':
-		add_token(l, TOKEN_COLON, 1);
-		l->index += 1;
-		return true;
-	case ';':
-		add_token(l, TOKEN_SEMICOLON, 1);
-		l->index += 1;
-		return true;
-	case '.':
-		if (l->source[l->index+1] == '.') {
-			add_token(l, TOKEN_DOUBLE_DOT, 2);
-			l->index += 2;
-		}  else {
-			add_token(l, TOKEN_DOT, 1);
-			l->index += 1;
-		}
-		return true;
-	case ',':
-		add_token(l, TOKEN_COMMA, 1);
-		l->index += 1;
-		return true;
-	case '(':
-		add_token(l, TOKEN_LPAREN, 1);
-		l->index += 1;
-		return true;
-	case ')':
-		add_token(l, TOKEN_RPAREN, 1);
-		l->index += 1;
-		return true;
-	case '[':
-		add_token(l, TOKEN_LSQUARE, 1);
-		l->index += 1;
-		return true;
-	case ']':
-		add_token(l, TOKEN_RSQUARE, 1);
-		l->index += 1;
-		return true;
-	case '{':
-		add_token(l, TOKEN_LCURLY, 1);
-		l->index += 1;
-		return true;
-	case '}':
-		add_token(l, TOKEN_RCURLY, 1);
-		l->index += 1;
-		return true;
-	case '\'':
-		if (l->source[l->index+1] == '\\') {
-			if (l->source[l->index+3] != '\'') {
-				add_error(l, "unclosed character literal.");
-				l->index += 1;
-				return true;
-			}
-			l->index += 1;
-			add_token(l, TOKEN_CHAR, 2);
-			l->index += 3;
-			return true;
-		} else {
-			if (l->source[l->index+2] != '\'') {
-				add_error(l, "unclosed character literal.");
-				l->index += 1;
-				return true;
-			}
-			l->index += 1;
-			add_token(l, TOKEN_CHAR, 1);
-			l->index += 2;
-			return true;
+		operator_accept[state] = operators[i].type;
+	}
+}
+
+static bool parse_operator(lexer *l)
+{
+	u8 *s = (u8 *)l->source + l->index;
+	usize state = 0, i = 0, len = 0;
+	token_type type = TOKEN_ERROR;
+	while ((state = operator_next[state][operator_class[s[i]]])) {
+		i += 1;
+		if (operator_accept[state]) {
+			type = operator_accept[state];
+			len = i;
 		}
-	default:
+	}
+	if (!len) {
 		return false;
 	}
+	add_token(l, type, len);
+	l->index += len;
+	return true;
+}
+
+static void parse_char(lexer *l)
+{
+	/* An escape is one byte longer, the backslash is part of the lexeme. */
+	usize len = l->source[l->index+1] == '\\' ? 2 : 1;
+	if (l->source[l->index + len + 1] != '\'') {
+		add_error(l, ERROR_UNCLOSED_CHAR);
+		l->index += 1;
+		return;
+	}
+	l->index += 1;
+	add_token(l, TOKEN_CHAR, len);
+	l->index += len + 1;
 }
 
-static void parse(lexer *l)
+/* Lex until a token is produced, returns false at the end of the source. */
+static bool lex_token(lexer *l)
 {
 	char c;
+	usize produced = l->tokens.len;
 
-	while (l->index <= l->size) {
+	while (l->index < l->size && l->tokens.len == produced) {
 		c = l->source[l->index];
-		l->column += 1;
-
-		if (c == '\n') {
-			l->index += 1;
-			l->row += 1;
-			l->column = 0;
-			continue;
-		}
-
-		usize head = l->index;
 
 		if (c == '/' && l->source[l->index+1] == '/') {
-			while (l->source[l->index] != '\n') {
-				l->index += 1;
-			}
-			l->column += (l->index - head - 1);
+			l->index = scan.line(l->source, l->index + 2, l->size);
+			continue;
 		}
 
 		if (isspace(c)) {
-			l->index += 1;
+			l->index = scan.whitespace(l->source, l->index + 1, l->size);
 			continue;
 		}
 
+		if (parse_operator(l)) {
+			continue;
+		}
 
-		if (parse_special(l)) {
-			l->column += (l->index - head - 1);
+		if (c == '\'') {
+			parse_char(l);
 			continue;
 		}
 
 		if (isdigit(c)) {
 			parse_number(l);
-			l->column += (l->index - head - 1);
 			continue;
 		}
 
 		if (isalpha(c)) {
 			parse_identifier(l);
-			l->column += (l->index - head - 1);
 			continue;
 		}
 
 		if (c == '"') {
 			l->index += 1;
 			parse_string(l);
-			l->column += (l->index - head - 1);
 			continue;
 		}
 
 		l->index += 1;
 	}
+
+	return l->tokens.len != produced;
 }
 
-lexer *lexer_init(char *source, usize size, arena *arena)
+/* Make sure that the token at index `i` has been lexed, if there is one. */
+static void fill(lexer *l, usize i)
+{
+	while (l->tokens.len <= i && lex_token(l));
+}
+
+/*
+ * The scanners and the operator tables are set up once for the whole
+ * program, lexers may be created on several threads at the same time.
+ */
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void tables_init(void)
+{
+	scan_init();
+	operators_init();
+}
+
+static lexer *create(char *source, usize size, arena *arena, bool streaming)
 {
 	lexer *lex = arena_alloc(arena, sizeof(lexer));
-	lex->column = 1;
-	lex->row = 1;
 	lex->index = 0;
 	lex->size = size;
-	lex->tokens = 0;
-	lex->tail = 0;
+	memset(&lex->tokens, 0x0, sizeof(token_list));
+	lex->streaming = streaming;
+	lex->cursor = 0;
 	lex->allocator = arena;
 	lex->source = source;
+	lex->lines = NULL;
+	lex->line_count = 0;
+	lex->symbols = interner_init(arena);
+
+	pthread_once(&tables_once, tables_init);
+
+	return lex;
+}
+
+lexer *lexer_init(char *source, usize size, arena *arena)
+{
+	lexer *lex = create(source, size, arena, false);
+	while (lex_token(lex));
+	return lex;
+}
+
+lexer *lexer_stream(char *source, usize size, arena *arena)
+{
+	return create(source, size, arena, true);
+}
+
+/* Chunks smaller than this are not worth a thread. */
+#define CHUNK_MIN (1 << 20)
+
+typedef struct {
+	lexer *lex;
+	arena arena;
+	/* Index of the first token of the chunk in the stitched list. */
+	usize first;
+	/* Chunk symbol ids to the ids of the stitched lexer. */
+	u32 *remap;
+	lexer *dst;
+	pthread_t thread;
+	bool spawned;
+} chunk;
+
+/*
+ * Return the offset following the first newline at or after `i` that
+ * ends a token. Strings and comments always stop at a newline, so the
+ * only token that can span one is a character literal spelled with a
+ * raw newline, and then the closing quote is the very next byte. After
+ * any other newline the lexer is back to its initial state.
+ */
+static usize chunk_boundary(char *s, usize i, usize size)
+{
+	while (i < size) {
+		char *nl = memchr(s + i, '\n', size - i);
+		if (!nl) return size;
+		i = nl - s + 1;
+		if (s[i] != '\'') return i;
+	}
+	return size;
+}
+
+static void *lex_chunk(void *arg)
+{
+	chunk *c = arg;
+	while (lex_token(c->lex));
+	return NULL;
+}
+
+static void *copy_chunk(void *arg)
+{
+	chunk *c = arg;
+	token_list *from = &c->lex->tokens;
+	token_list *to = &c->dst->tokens;
+	memcpy(to->types + c->first, from->types, from->len * sizeof(*from->types));
+	memcpy(to->offsets + c->first, from->offsets, from->len * sizeof(*from->offsets));
+	memcpy(to->lengths + c->first, from->lengths, from->len * sizeof(*from->lengths));
+	for (usize i = 0; i < from->len; i++) {
+		to->symbols[c->first + i] = c->remap[from->symbols[i]];
+	}
+	return NULL;
+}
+
+/*
+ * Arena for the lexer of a chunk of `size` bytes, enough for its
+ * interner at worst: the tokens are malloc'ed. Names are separated by
+ * at least one byte, so there are at most size / 2 + 1 of them, each
+ * with a NUL and the alignment padding. The tables grow by doubling and
+ * leave the old ones behind, so all their sizes add up.
+ */
+static usize chunk_arena(usize size)
+{
+	usize names = size / 2 + 1;
+	usize bytes = sizeof(lexer) + sizeof(interner) + size + names * 16;
+	usize slots = 1024, entries = 512;
+	bytes += slots * sizeof(u32) + entries * (sizeof(char *) + 2 * sizeof(u32));
+	while (names * 2 > slots) {
+		slots *= 2;
+		bytes += slots * sizeof(u32);
+	}
+	while (names + 1 > entries) {
+		entries *= 2;
+		bytes += entries * (sizeof(char *) + 2 * sizeof(u32));
+	}
+	/* The padding of the tables. */
+	return bytes + 0x1000;
+}
+
+/* Run `job` on every chunk, the first one on the calling thread. */
+static void run_chunks(void *(*job)(void *), chunk *chunks, usize n)
+{
+	for (usize i = 1; i < n; i++) {
+		chunks[i].spawned = pthread_create(&chunks[i].thread, NULL, job, &chunks[i]) == 0;
+		if (!chunks[i].spawned) job(&chunks[i]);
+	}
+	job(&chunks[0]);
+	for (usize i = 1; i < n; i++) {
+		if (chunks[i].spawned) pthread_join(chunks[i].thread, NULL);
+	}
+}
+
+lexer *lexer_parallel(char *source, usize size, arena *arena, usize threads)
+{
+	lexer *lex = create(source, size, arena, false);
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if (threads > size / CHUNK_MIN) {
+		threads = size / CHUNK_MIN;
+	}
+	if (threads < 2) {
+		while (lex_token(lex));
+		return lex;
+	}
 
-	keywords = arena_alloc(arena, sizeof(trie_node));
-	trie_insert(keywords, lex->allocator, "true", TOKEN_TRUE);
-	trie_insert(keywords, lex->allocator, "false", TOKEN_FALSE);
-	trie_insert(keywords, lex->allocator, "struct", TOKEN_STRUCT);
-	trie_insert(keywords, lex->allocator, "enum", TOKEN_ENUM);
-	trie_insert(keywords, lex->allocator, "union", TOKEN_UNION);
-	trie_insert(keywords, lex->allocator, "loop", TOKEN_LOOP);
-	trie_insert(keywords, lex->allocator, "while", TOKEN_WHILE);
-	trie_insert(keywords, lex->allocator, "until", TOKEN_UNTIL);
-	trie_insert(keywords, lex->allocator, "goto", TOKEN_GOTO);
-	trie_insert(keywords, lex->allocator, "if", TOKEN_IF);
-	trie_insert(keywords, lex->allocator, "else", TOKEN_ELSE);
-	trie_insert(keywords, lex->allocator, "switch", TOKEN_SWITCH);
-	trie_insert(keywords, lex->allocator, "break", TOKEN_BREAK);
-	trie_insert(keywords, lex->allocator, "defer", TOKEN_DEFER);
-	trie_insert(keywords, lex->allocator, "return", TOKEN_RETURN);
-	trie_insert(keywords, lex->allocator, "import", TOKEN_IMPORT);
-	trie_insert(keywords, lex->allocator, "const", TOKEN_CONST);
-	trie_insert(keywords, lex->allocator, "extern", TOKEN_EXTERN);
-	trie_insert(keywords, lex->allocator, "volatile", TOKEN_VOLATILE);
-
-	parse(lex);
+	/* Every chunk gets its own arena and interner, nothing is shared. */
+	chunk *chunks = malloc(threads * sizeof(chunk));
+	usize n = 0;
+	for (usize start = 0; start < size; n++) {
+		usize end = chunk_boundary(source, start + (size - start) / (threads - n), size);
+		chunk *c = &chunks[n];
+		c->arena = arena_init(chunk_arena(end - start));
+		c->lex = create(source, end, &c->arena, false);
+		c->lex->index = start;
+		c->dst = lex;
+		start = end;
+	}
+	run_chunks(lex_chunk, chunks, n);
+
+	token_list *t = &lex->tokens;
+	usize capacity = 1024;
+	for (usize i = 0; i < n; i++) {
+		chunks[i].first = t->len;
+		t->len += chunks[i].lex->tokens.len;
+	}
+	while (capacity < t->len) {
+		capacity *= 2;
+	}
+	t->types = malloc(capacity * sizeof(*t->types));
+	t->offsets = malloc(capacity * sizeof(*t->offsets));
+	t->lengths = malloc(capacity * sizeof(*t->lengths));
+	t->symbols = malloc(capacity * sizeof(*t->symbols));
+	t->capacity = capacity;
 
+	/*
+	 * Chunk symbols are numbered in order of first appearance, so
+	 * interning them chunk after chunk hands out the same ids as
+	 * lexing the whole source on one thread.
+	 */
+	for (usize i = 0; i < n; i++) {
+		interner *in = chunks[i].lex->symbols;
+		chunks[i].remap = malloc(in->count * sizeof(u32));
+		chunks[i].remap[0] = 0;
+		for (u32 id = 1; id < in->count; id++) {
+			chunks[i].remap[id] = intern(lex->symbols, in->names[id], in->lengths[id]);
+		}
+	}
+	run_chunks(copy_chunk, chunks, n);
+
+	for (usize i = 0; i < n; i++) {
+		free(chunks[i].remap);
+		lexer_deinit(chunks[i].lex);
+		arena_deinit(chunks[i].arena);
+	}
+	free(chunks);
+	lex->index = size;
 	return lex;
 }
+
+lexer *lexer_view(lexer *l, usize start, usize end, arena *arena)
+{
+	lexer *view = arena_alloc(arena, sizeof(lexer));
+	*view = *l;
+	view->tokens.len = end;
+	view->cursor = start;
+	view->lines = NULL;
+	view->line_count = 0;
+	view->allocator = arena;
+	return view;
+}
+
+void lexer_view_deinit(lexer *view)
+{
+	free(view->lines);
+	view->lines = NULL;
+}
+
+void lexer_restart(lexer *l, char *source, usize size, usize index)
+{
+	token_list *t = &l->tokens;
+	if (!l->streaming) {
+		/* Tokens lexed up front, a ring of a few slots does from now on. */
+		lexer_deinit(l);
+		l->streaming = true;
+	}
+	t->base = t->len = 0;
+	l->cursor = 0;
+	l->source = source;
+	l->size = size;
+	l->index = index;
+	free(l->lines);
+	l->lines = NULL;
+	l->line_count = 0;
+}
+
+static token get_token(lexer *l, usize i)
+{
+	token_list *t = &l->tokens;
+	token tok;
+	if (i >= t->len) {
+		tok.type = TOKEN_END;
+		tok.offset = l->size;
+		tok.lexeme = l->source + l->size;
+		tok.lexeme_len = 0;
+		tok.symbol = 0;
+		return tok;
+	}
+
+	usize slot = i & (t->capacity - 1);
+	tok.type = t->types[slot];
+	tok.symbol = t->symbols[slot];
+	tok.offset = t->offsets[slot];
+	if (tok.type == TOKEN_ERROR) {
+		tok.lexeme = errors[t->lengths[slot]];
+		tok.lexeme_len = strlen(tok.lexeme);
+	} else {
+		tok.lexeme = l->source + t->offsets[slot];
+		tok.lexeme_len = t->lengths[slot];
+	}
+	return tok;
+}
+
+token lexer_peek(lexer *l, usize n)
+{
+	fill(l, l->cursor + n);
+	return get_token(l, l->cursor + n);
+}
+
+token_type lexer_peek_type(lexer *l, usize n)
+{
+	token_list *t = &l->tokens;
+	fill(l, l->cursor + n);
+	if (l->cursor + n >= t->len) {
+		return TOKEN_END;
+	}
+	return t->types[(l->cursor + n) & (t->capacity - 1)];
+}
+
+token lexer_next(lexer *l)
+{
+	fill(l, l->cursor);
+	token tok = get_token(l, l->cursor);
+	if (l->cursor < l->tokens.len) {
+		l->cursor += 1;
+	}
+	return tok;
+}
+
+source_pos lexer_locate(lexer *l, u32 offset)
+{
+	if (!l->lines) {
+		usize n = scan.newlines(l->source, l->size, NULL);
+		l->lines = malloc((n + 1) * sizeof(u32));
+		l->lines[0] = 0;
+		scan.newlines(l->source, l->size, l->lines + 1);
+		l->line_count = n + 1;
+	}
+
+	/* Find the last line starting at or before `offset`. */
+	usize lo = 0;
+	usize hi = l->line_count;
+	while (hi - lo > 1) {
+		usize mid = lo + (hi - lo) / 2;
+		if (l->lines[mid] <= offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (source_pos){ .row = lo + 1, .column = offset - l->lines[lo] + 1 };
+}
+
+void lexer_deinit(lexer *l)
+{
+	free(l->tokens.types);
+	free(l->tokens.offsets);
+	free(l->tokens.lengths);
+	free(l->tokens.symbols);
+	memset(&l->tokens, 0x0, sizeof(token_list));
+	free(l->lines);
+	l->lines = NULL;
+}
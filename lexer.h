@@ -2,6 +2,7 @@
 #define LEXER_H
 
 #include "utils.h"
+#include <stdbool.h>
 
 typedef enum {
 	TOKEN_ERROR,
@@ -76,22 +77,95 @@ typedef enum {
 	TOKEN_UNION
 } token_type;
 
-typedef struct _token {
+typedef struct {
 	token_type type;
-	source_pos position;
+	/* Byte offset of the token in the source. */
+	u32 offset;
 	char *lexeme;
 	usize lexeme_len;
-	struct _token *next;
+	/* Interned name of identifiers, 0 for every other token. */
+	u32 symbol;
 } token;
 
+/*
+ * Tokens are stored as a structure of arrays: the lexer appends to
+ * every column and the parser walks them by index. Lexemes are kept
+ * as a 32 bit offset into the source plus their length, for error
+ * tokens the length is the index of the message instead. Identifiers
+ * are interned as they are produced.
+ *
+ * The columns are a ring of `capacity` slots (a power of two) holding
+ * the tokens in [base, len), token `i` lives in slot `i & (capacity - 1)`.
+ * When the whole source is lexed up front `base` stays at 0 and the
+ * ring just grows.
+ */
+typedef struct {
+	u8 *types;
+	u32 *offsets;
+	u32 *lengths;
+	u32 *symbols;
+	usize base;
+	usize len;
+	usize capacity;
+} token_list;
+
 typedef struct {
-	usize column, row, index, size;
+	usize index, size;
 	char *source;
-	token *tokens;
-	token *tail;
+	/* Offset of the first byte of every line, built on demand. */
+	u32 *lines;
+	usize line_count;
+	token_list tokens;
+	interner *symbols;
+	bool streaming;
+	/* Index of the next token returned by `lexer_next()`. */
+	usize cursor;
 	arena *allocator;
 } lexer;
 
+/* Tokenize the whole source up front. */
 lexer *lexer_init(char *source, usize size, arena *arena);
+/*
+ * Tokenize on demand: tokens are produced as the parser asks for them
+ * and the slots of the ones already consumed are reused, so memory
+ * stays constant no matter how large the source is.
+ */
+lexer *lexer_stream(char *source, usize size, arena *arena);
+/*
+ * Tokenize the whole source up front on `threads` threads, or one per
+ * CPU when it is 0. The source is split at newlines in chunks of at
+ * least a megabyte that are lexed independently and stitched in order,
+ * the result is the same as with `lexer_init()`.
+ */
+lexer *lexer_parallel(char *source, usize size, arena *arena, usize threads);
+/*
+ * A lexer over the tokens [start, end) of `l`, which must have been
+ * tokenized up front: past `end` only `TOKEN_END` is returned. The
+ * columns are shared with `l`, so it must outlive the view and only
+ * `lexer_view_deinit()` may be called on it.
+ */
+lexer *lexer_view(lexer *l, usize start, usize end, arena *arena);
+void lexer_view_deinit(lexer *view);
+/*
+ * Drop the tokens of `l` and lex `source` from byte `index` on demand,
+ * as `lexer_stream()` does. The interner is kept, so names get the same
+ * symbols as before: `parser_edit()` lexes the text around an edit
+ * with it.
+ */
+void lexer_restart(lexer *l, char *source, usize size, usize index);
+/* Return the keyword spelled by `s`, or `TOKEN_IDENTIFIER`. */
+token_type lexer_keyword(char *s, usize len);
+/* Look `n` tokens past the cursor, past the end a `TOKEN_END` is returned. */
+token lexer_peek(lexer *l, usize n);
+token_type lexer_peek_type(lexer *l, usize n);
+/* Return the token under the cursor and advance it. */
+token lexer_next(lexer *l);
+/*
+ * Turn a byte offset into a row and a column, both starting from 1.
+ * Positions are only needed for diagnostics, so the table of line
+ * starts is built the first time this is called.
+ */
+source_pos lexer_locate(lexer *l, u32 offset);
+void lexer_deinit(lexer *l);
 
 #endif
@@ -1,27 +1,44 @@
+#define STB_DS_IMPLEMENTATION
 #include "parser.h"
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-bool has_errors = false;
+node_id parse_expression(parser *p);
+static node_id parse_statement(parser *p);
+static node_id parse_type(parser *p);
 
-ast_node *parse_expression(parser *p);
-static ast_node *parse_statement(parser *p);
-static ast_node *parse_type(parser *p);
-
-/* Consume a token in the list. */
+/*
+ * Consume a token in the list. Every token goes through here once, so
+ * this is where the errors of the lexer join the parser's, in the order
+ * of the source: the message is the lexeme of the error token.
+ */
 static void advance(parser *p)
 {
-	p->previous = p->tokens;
-	if (p->tokens)
-		p->tokens = p->tokens->next;
+	p->previous = lexer_next(p->lexer);
+	if (p->previous.type == TOKEN_ERROR) {
+		diagnostic d = { p->previous.offset, p->previous.lexeme };
+		arrput(p->diagnostics, d);
+	}
 }
 
 /* Get the current token in the list, without consuming */
-static token *peek(parser *p)
+static token peek(parser *p)
 {
-	return p->tokens;
+	return lexer_peek(p->lexer, 0);
+}
+
+/* Get the type of the token `n` positions after the current one. */
+static token_type peek_type(parser *p, usize n)
+{
+	return lexer_peek_type(p->lexer, n);
 }
 
 /*
@@ -30,26 +47,16 @@ static token *peek(parser *p)
  */
 static bool match_peek(parser *p, token_type type)
 {
-	if (p->tokens)
-	{
-		return p->tokens->type == type;
-	}
-	else
-	{
-		return false;
-	}
+	return peek_type(p, 0) == type;
 }
 
 /* Same as `match_peek()` but it consumes the token. */
 static bool match(parser *p, token_type type)
 {
-	if (p->tokens)
+	if (peek_type(p, 0) == type)
 	{
-		if (p->tokens->type == type)
-		{
-			advance(p);
-			return true;
-		}
+		advance(p);
+		return true;
 	}
 	return false;
 }
@@ -65,14 +72,14 @@ static void parser_sync(parser *p)
 {
 	advance(p);
 
-	while (p->tokens)
+	while (!match_peek(p, TOKEN_END))
 	{
-		if (p->previous->type == TOKEN_SEMICOLON || p->previous->type == TOKEN_RCURLY)
+		if (p->previous.type == TOKEN_SEMICOLON || p->previous.type == TOKEN_RCURLY)
 		{
 			return;
 		}
 
-		switch (p->tokens->type)
+		switch (peek_type(p, 0))
 		{
 		case TOKEN_STRUCT:
 		case TOKEN_ENUM:
@@ -88,179 +95,169 @@ static void parser_sync(parser *p)
 	}
 }
 
-/* Print the error message and sync the parser. */
+/* Record the error message and sync the parser. */
 static void error(parser *p, char *msg)
 {
-	printf("\x1b[31m\x1b[1merror\x1b[0m\x1b[1m:%ld:%ld:\x1b[0m %s\n", p->previous->position.row, p->previous->position.column, msg);
-	has_errors = true;
+	diagnostic d = { p->previous.offset, msg };
+	arrput(p->diagnostics, d);
 	parser_sync(p);
 }
 
-static ast_node *parse_call(parser *p)
+static node_id add_node(parser *p, node_type kind, u32 offset, u32 data)
 {
-	ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-	node->type = NODE_CALL;
-	node->position = p->previous->position;
-	node->expr.call.name = peek(p)->lexeme;
-	node->expr.call.name_len = peek(p)->lexeme_len;
-	advance(p);
-	/* Skip also the opening `(` */
-	advance(p);
-	/* Call without parameters */
-	if (match(p, TOKEN_RPAREN))
-	{
-		node->expr.call.parameters = NULL;
-		return node;
-	}
+	ast *a = p->ast;
+	arrput(a->kinds, kind);
+	arrput(a->offsets, offset - p->base);
+	arrput(a->data, data);
+	return arrlen(a->kinds) - 1;
+}
 
-	snapshot arena_start = arena_snapshot(p->allocator);
-	node->expr.call.parameters = arena_alloc(p->allocator, sizeof(ast_node));
-	node->expr.call.parameters->type = NODE_UNIT;
-	node->expr.call.parameters->expr.unit_node.expr = parse_expression(p);
-	ast_node *tail = node->expr.call.parameters;
-	node->expr.call.param_len = 1;
+static node_id add_binary(parser *p, node_type kind, u32 offset, node_id left, node_id right, binary_op op)
+{
+	ast_binary b = { left, right, op };
+	arrput(p->ast->binaries, b);
+	return add_node(p, kind, offset, arrlen(p->ast->binaries) - 1);
+}
 
-	/* In this case, there is only one parameter */
-	if (match(p, TOKEN_RPAREN))
-	{
-		return node;
+static node_id add_unary(parser *p, node_type kind, u32 offset, node_id operand, u32 op)
+{
+	ast_unary u = { operand, op };
+	arrput(p->ast->unaries, u);
+	return add_node(p, kind, offset, arrlen(p->ast->unaries) - 1);
+}
+
+/*
+ * Move the elements pushed on the scratch stack since `base` to
+ * `children`. Returns the index of the first one.
+ */
+static u32 flush_list(parser *p, usize base, u32 *len)
+{
+	u32 start = arrlen(p->ast->children);
+	*len = arrlen(p->scratch) - base;
+	if (*len > 0) {
+		memcpy(arraddnptr(p->ast->children, *len), p->scratch + base, *len * sizeof(node_id));
+		arrsetlen(p->scratch, base);
 	}
+	return start;
+}
 
-	if (match(p, TOKEN_COMMA))
-	{
-		ast_node *expr = parse_expression(p);
-		if (expr)
-		{
-			while (!match(p, TOKEN_RPAREN))
-			{
-				if (!match(p, TOKEN_COMMA))
-				{
-					error(p, "expected `)`.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-				tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-				tail->expr.unit_node.next->expr.unit_node.expr = expr;
-				tail = tail->expr.unit_node.next;
-				tail->type = NODE_UNIT;
-				expr = parse_expression(p);
-				if (!expr)
-				{
-					error(p, "expected `)`.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-				node->expr.call.param_len += 1;
-			}
+static node_id add_list(parser *p, node_type kind, u32 offset, usize base)
+{
+	ast_list list;
+	list.start = flush_list(p, base, &list.len);
+	arrput(p->ast->lists, list);
+	return add_node(p, kind, offset, arrlen(p->ast->lists) - 1);
+}
 
-			tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-			tail->expr.unit_node.next->expr.unit_node.expr = expr;
-			tail = tail->expr.unit_node.next;
-			tail->type = NODE_UNIT;
-		}
-		else
-		{
+/*
+ * Parse a comma separated list of expressions up to `close`, the
+ * opening token is already consumed. The elements are left on the
+ * scratch stack. Returns false on errors.
+ */
+static bool parse_list(parser *p, token_type close, char *missing)
+{
+	if (match(p, close)) {
+		return true;
+	}
+
+	do {
+		node_id expr = parse_expression(p);
+		if (!expr) {
 			error(p, "expected expression.");
-			arena_reset_to_snapshot(p->allocator, arena_start);
-			return NULL;
+			return false;
 		}
+		arrput(p->scratch, expr);
+	} while (match(p, TOKEN_COMMA));
+
+	if (!match(p, close)) {
+		error(p, missing);
+		return false;
 	}
-	else
-	{
-		error(p, "expected `)`.");
-		arena_reset_to_snapshot(p->allocator, arena_start);
-		return NULL;
+	return true;
+}
+
+static node_id parse_call(parser *p)
+{
+	u32 offset = p->previous.offset;
+	u32 symbol = peek(p).symbol;
+	advance(p);
+	/* Skip also the opening `(` */
+	advance(p);
+
+	usize base = arrlen(p->scratch);
+	if (!parse_list(p, TOKEN_RPAREN, "expected `)`.")) {
+		arrsetlen(p->scratch, base);
+		return 0;
 	}
 
-	return node;
+	ast_call call = { symbol };
+	call.args = flush_list(p, base, &call.argc);
+	arrput(p->ast->calls, call);
+	return add_node(p, NODE_CALL, offset, arrlen(p->ast->calls) - 1);
+}
+
+/* Parse a struct initializer, the leading `.{` is already consumed. */
+static node_id parse_struct_init(parser *p)
+{
+	u32 offset = p->previous.offset;
+	usize base = arrlen(p->scratch);
+	if (!parse_list(p, TOKEN_RCURLY, "expected `}`.")) {
+		arrsetlen(p->scratch, base);
+		return 0;
+	}
+	return add_list(p, NODE_STRUCT_INIT, offset, base);
 }
 
-/* Parse expressions with the highest precedence. */
-static ast_node *parse_factor(parser *p)
+/* Parse the operands of an expression: literals, names, calls and initializers. */
+static node_id parse_factor(parser *p)
 {
-	token *t = peek(p);
+	token t = peek(p);
 	if (match(p, TOKEN_INTEGER))
 	{
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_INTEGER;
-		node->position = p->previous->position;
-		node->expr.integer = parse_int(t->lexeme, t->lexeme_len);
+		arrput(p->ast->integers, parse_int(t.lexeme, t.lexeme_len));
+		node_id node = add_node(p, NODE_INTEGER, p->previous.offset, arrlen(p->ast->integers) - 1);
 		if (match(p, TOKEN_DOUBLE_DOT)) {
-			ast_node *range = arena_alloc(p->allocator, sizeof(ast_node));
-			range->type = NODE_RANGE;
-			range->expr.binary.left = node;
-			range->expr.binary.operator = OP_PLUS;
-			snapshot snap = arena_snapshot(p->allocator);
-			ast_node *end = parse_factor(p);
-			if (!end) {
-				range->expr.binary.right = NULL;
-			} else if (end->type != NODE_INTEGER) {
-				arena_reset_to_snapshot(p->allocator, snap);
+			u32 offset = p->previous.offset;
+			node_id end = parse_factor(p);
+			if (end && p->ast->kinds[end] != NODE_INTEGER) {
 				error(p, "expected integer.");
-				return NULL;
-			} else {
-				range->expr.binary.right = end;
+				return 0;
 			}
-			return range;
+			return add_binary(p, NODE_RANGE, offset, node, end, OP_PLUS);
 		}
 		return node;
 	}
 	else if (match(p, TOKEN_FLOAT))
 	{
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_FLOAT;
-		node->position = p->previous->position;
-		node->expr.flt = parse_float(t->lexeme, t->lexeme_len);
-		return node;
+		arrput(p->ast->floats, parse_float(t.lexeme, t.lexeme_len));
+		return add_node(p, NODE_FLOAT, p->previous.offset, arrlen(p->ast->floats) - 1);
 	}
 	else if (match(p, TOKEN_TRUE)) {
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_BOOL;
-		node->position = p->previous->position;
-		node->expr.boolean = 1;
-		return node;
+		return add_node(p, NODE_BOOL, p->previous.offset, 1);
 	}
 	else if (match(p, TOKEN_FALSE)) {
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_BOOL;
-		node->position = p->previous->position;
-		node->expr.boolean = 0;
-		return node;
+		return add_node(p, NODE_BOOL, p->previous.offset, 0);
 	}
 	else if (match_peek(p, TOKEN_IDENTIFIER))
 	{
 		/* If a `(` is found after an identifier, it should be a call. */
-		if (p->tokens->next && p->tokens->next->type == TOKEN_LPAREN)
+		if (peek_type(p, 1) == TOKEN_LPAREN)
 		{
 			return parse_call(p);
 		}
 		advance(p);
-
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_IDENTIFIER;
-		node->position = p->previous->position;
-		node->expr.string.start = t->lexeme;
-		node->expr.string.len = t->lexeme_len;
-		return node;
+		return add_node(p, NODE_IDENTIFIER, p->previous.offset, t.symbol);
 	}
 	else if (match(p, TOKEN_STRING))
 	{
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_STRING;
-		node->position = p->previous->position;
-		node->expr.string.start = t->lexeme;
-		node->expr.string.len = t->lexeme_len;
-		return node;
+		return add_node(p, NODE_STRING, p->previous.offset, t.lexeme_len);
 	}
 	else if (match(p, TOKEN_CHAR))
 	{
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_CHAR;
-		node->position = p->previous->position;
-		if (t->lexeme_len == 2)
+		char c = *t.lexeme;
+		if (t.lexeme_len == 2)
 		{
-			char c;
-			switch (t->lexeme[1])
+			switch (t.lexeme[1])
 			{
 			case 'n':
 				c = '\n';
@@ -282,533 +279,380 @@ static ast_node *parse_factor(parser *p)
 				break;
 			default:
 				error(p, "invalid escape code.");
-				return NULL;
+				return 0;
 			}
-			node->expr.ch = c;
-		}
-		else
-		{
-			node->expr.ch = *(t->lexeme);
-		}
-		return node;
-	}
-	else if (match(p, TOKEN_LPAREN))
-	{
-		ast_node *node = parse_expression(p);
-		if (!match(p, TOKEN_RPAREN))
-		{
-			error(p, "unclosed parenthesis");
-			return NULL;
 		}
-
-		return node;
+		return add_node(p, NODE_CHAR, p->previous.offset, (u8)c);
 	}
-
-	return NULL;
-}
-
-ast_node *parse_unary(parser *p)
-{
-	if (match(p, TOKEN_PLUS_PLUS) || match(p, TOKEN_MINUS) || match(p, TOKEN_MINUS_MINUS) || match(p, TOKEN_STAR) || match(p, TOKEN_AND) || match(p, TOKEN_BANG))
+	else if (match(p, TOKEN_ERROR))
 	{
-		unary_op op;
-		switch (p->previous->type)
-		{
-		case TOKEN_PLUS_PLUS:
-			op = UOP_INCR;
-			break;
-		case TOKEN_MINUS:
-			op = UOP_MINUS;
-			break;
-		case TOKEN_MINUS_MINUS:
-			op = UOP_DECR;
-			break;
-		case TOKEN_STAR:
-			op = UOP_DEREF;
-			break;
-		case TOKEN_AND:
-			op = UOP_REF;
-			break;
-		case TOKEN_BANG:
-			op = UOP_NOT;
-			break;
-		default:
-			goto end;
-		}
-
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_UNARY;
-		node->position = p->previous->position;
-		node->expr.unary.operator = op;
-		node->expr.unary.right = parse_expression(p);
-
-		return node;
+		/* A zero stands in for the broken literal, the statement goes on. */
+		arrput(p->ast->integers, 0);
+		return add_node(p, NODE_INTEGER, p->previous.offset, arrlen(p->ast->integers) - 1);
 	}
-
-	/* Type cast. */
-	if (match_peek(p, TOKEN_LPAREN) && p->tokens->next && p->tokens->next->type == TOKEN_IDENTIFIER && p->tokens->next->next && p->tokens->next->next->type == TOKEN_RPAREN)
+	else if (match_peek(p, TOKEN_DOT) && peek_type(p, 1) == TOKEN_LCURLY)
 	{
 		advance(p);
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_CAST;
-		node->position = p->previous->position;
-		node->expr.cast.type = parse_type(p);
 		advance(p);
-		advance(p);
-		node->expr.cast.value = parse_expression(p);
-		return node;
+		return parse_struct_init(p);
 	}
 
-end:
-	return parse_factor(p);
+	return 0;
 }
 
-ast_node *parse_term(parser *p)
+/* Subscripts, member accesses and postfix `++`/`--` applied to `left`. */
+static node_id parse_postfix(parser *p, node_id left)
 {
-	ast_node *left = parse_unary(p);
+	for (;;) {
+		if (match(p, TOKEN_LSQUARE)) {
+			node_id index = parse_expression(p);
+			left = add_binary(p, NODE_ARRAY_SUBSCRIPT, p->previous.offset, left, index, 0);
 
-	while (match_peek(p, TOKEN_STAR) || match_peek(p, TOKEN_SLASH))
-	{
-		binary_op op = peek(p)->type == TOKEN_STAR ? OP_MUL : OP_DIV;
-		advance(p);
-		ast_node *right = parse_factor(p);
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_BINARY;
-		node->position = p->previous->position;
-		node->expr.binary.left = left;
-		node->expr.binary.right = right;
-		node->expr.binary.operator = op;
-		left = node;
+			if (!match(p, TOKEN_RSQUARE))
+			{
+				error(p, "expected `]`.");
+				return 0;
+			}
+		} else if (match_peek(p, TOKEN_DOT) && peek_type(p, 1) != TOKEN_LCURLY) {
+			advance(p);
+			if (!match_peek(p, TOKEN_IDENTIFIER)) {
+				error(p, "expected identifier after member access.");
+				return 0;
+			}
+			u32 offset = p->previous.offset;
+			node_id member = parse_factor(p);
+			left = add_binary(p, NODE_ACCESS, offset, left, member, 0);
+		} else if (match(p, TOKEN_PLUS_PLUS) || match(p, TOKEN_MINUS_MINUS)) {
+			unary_op op = p->previous.type == TOKEN_PLUS_PLUS ? UOP_INCR : UOP_DECR;
+			left = add_unary(p, NODE_POSTFIX, p->previous.offset, left, op);
+		} else {
+			return left;
+		}
 	}
-
-	return left;
 }
 
 /*
- * Following the recursive descent parser algorithm, this
- * parses all the arithmetic expressions.
+ * Binding power of the binary operators, from the loosest to the
+ * tightest. Assignments are the only right associative ones, prefix
+ * operators and casts bind tighter than all of them.
  */
-ast_node *parse_expression(parser *p)
+enum {
+	PREC_NONE,
+	PREC_ASSIGN,
+	PREC_OR,
+	PREC_AND,
+	PREC_EQUALITY,
+	PREC_COMPARISON,
+	PREC_BOR,
+	PREC_BXOR,
+	PREC_BAND,
+	PREC_SHIFT,
+	PREC_SUM,
+	PREC_PRODUCT,
+	PREC_PREFIX,
+};
+
+static const struct {
+	u8 power;
+	binary_op op;
+} binary_ops[TOKEN_UNION + 1] = {
+	[TOKEN_EQ] = { PREC_ASSIGN, OP_ASSIGN },
+	[TOKEN_PLUS_EQ] = { PREC_ASSIGN, OP_PLUS_EQ },
+	[TOKEN_MINUS_EQ] = { PREC_ASSIGN, OP_MINUS_EQ },
+	[TOKEN_STAR_EQ] = { PREC_ASSIGN, OP_MUL_EQ },
+	[TOKEN_SLASH_EQ] = { PREC_ASSIGN, OP_DIV_EQ },
+	[TOKEN_PERC_EQ] = { PREC_ASSIGN, OP_MOD_EQ },
+	[TOKEN_AND_EQ] = { PREC_ASSIGN, OP_BAND_EQ },
+	[TOKEN_PIPE_EQ] = { PREC_ASSIGN, OP_BOR_EQ },
+	[TOKEN_HAT_EQ] = { PREC_ASSIGN, OP_BXOR_EQ },
+	[TOKEN_LSHIFT_EQ] = { PREC_ASSIGN, OP_LSHIFT_EQ },
+	[TOKEN_RSHIFT_EQ] = { PREC_ASSIGN, OP_RSHIFT_EQ },
+	[TOKEN_OR] = { PREC_OR, OP_OR },
+	[TOKEN_DOUBLE_AND] = { PREC_AND, OP_AND },
+	[TOKEN_DOUBLE_EQ] = { PREC_EQUALITY, OP_EQ },
+	[TOKEN_NOT_EQ] = { PREC_EQUALITY, OP_NEQ },
+	[TOKEN_LESS_THAN] = { PREC_COMPARISON, OP_LT },
+	[TOKEN_GREATER_THAN] = { PREC_COMPARISON, OP_GT },
+	[TOKEN_LESS_EQ] = { PREC_COMPARISON, OP_LE },
+	[TOKEN_GREATER_EQ] = { PREC_COMPARISON, OP_GE },
+	[TOKEN_PIPE] = { PREC_BOR, OP_BOR },
+	[TOKEN_HAT] = { PREC_BXOR, OP_BXOR },
+	[TOKEN_AND] = { PREC_BAND, OP_BAND },
+	[TOKEN_LSHIFT] = { PREC_SHIFT, OP_LSHIFT },
+	[TOKEN_RSHIFT] = { PREC_SHIFT, OP_RSHIFT },
+	[TOKEN_PLUS] = { PREC_SUM, OP_PLUS },
+	[TOKEN_MINUS] = { PREC_SUM, OP_MINUS },
+	[TOKEN_STAR] = { PREC_PRODUCT, OP_MUL },
+	[TOKEN_SLASH] = { PREC_PRODUCT, OP_DIV },
+	[TOKEN_PERC] = { PREC_PRODUCT, OP_MOD },
+};
+
+static bool prefix_op(token_type type, unary_op *op)
 {
-	ast_node *left = parse_term(p);
-
-	while (match_peek(p, TOKEN_PLUS) || match_peek(p, TOKEN_MINUS))
-	{
-		binary_op op = peek(p)->type == TOKEN_PLUS ? OP_PLUS : OP_MINUS;
-		advance(p);
-		ast_node *right = parse_term(p);
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_BINARY;
-		node->position = p->previous->position;
-		node->expr.binary.left = left;
-		node->expr.binary.right = right;
-		node->expr.binary.operator = op;
-		left = node;
+	switch (type) {
+	case TOKEN_PLUS_PLUS: *op = UOP_INCR; return true;
+	case TOKEN_MINUS: *op = UOP_MINUS; return true;
+	case TOKEN_MINUS_MINUS: *op = UOP_DECR; return true;
+	case TOKEN_STAR: *op = UOP_DEREF; return true;
+	case TOKEN_AND: *op = UOP_REF; return true;
+	case TOKEN_BANG: *op = UOP_NOT; return true;
+	default: return false;
 	}
+}
 
-	/*
-	 * If after parsing an expression a `[` character
-	 * is found, it should be an array subscript expression.
-	 */
-	if (match_peek(p, TOKEN_LSQUARE)) {
-		while (match(p, TOKEN_LSQUARE)) {
-			ast_node *index = parse_expression(p);
-			ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-			node->type = NODE_ARRAY_SUBSCRIPT;
-			node->position = p->previous->position;
-			node->expr.subscript.expr = left;
-			node->expr.subscript.index = index;
-
-			if (!match(p, TOKEN_RSQUARE))
-			{
-				error(p, "expected `]`.");
-				return NULL;
-			}
-
-			left = node;
+/*
+ * The types sema registers before any declaration, see `sema_init()`.
+ * The parser doesn't know the types the program declares, so with one
+ * of those `(name)-x` stays a subtraction from `name`, and sema reports
+ * `name` as a type used as a value: the cast is spelled `(name)(-x)`.
+ */
+static const char *builtin_types[] = {
+	"void", "bool", "u8", "u16", "u32", "u64", "i8", "i16", "i32", "i64", "f32", "f64",
+};
 
+static bool builtin_type(token t)
+{
+	for (usize i = 0; i < sizeof(builtin_types) / sizeof(*builtin_types); i++) {
+		if (t.lexeme_len == strlen(builtin_types[i]) && memcmp(t.lexeme, builtin_types[i], t.lexeme_len) == 0) {
+			return true;
 		}
 	}
+	return false;
+}
 
-	/*
-	 * If after parsing an expression a `.` character
-	 * is found, it should be a member access expression.
-	 */
-	if (match_peek(p, TOKEN_DOT) && p->tokens->next && p->tokens->next->type != TOKEN_LCURLY) {
-		while (match(p, TOKEN_DOT)) {
-			if (!match_peek(p, TOKEN_IDENTIFIER)) {
-				error(p, "expected identifier after member access.");
-				return NULL;
-			}
-			ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-			node->type = NODE_ACCESS;
-			node->position = p->previous->position;
-			node->expr.access.expr = left;
-			node->expr.access.member = parse_factor(p);
-
-			left = node;
-		}
+/*
+ * `(name)` is a cast only when an operand follows, so that `(x) + 1`
+ * and `((x))` are still parenthesized expressions. `-`, `*` and `&`
+ * could be either, they start an operand after a builtin type only:
+ * `(i32)-1` is a cast, `(x)-1` a subtraction.
+ */
+static bool starts_operand(parser *p)
+{
+	switch (peek_type(p, 3)) {
+	case TOKEN_IDENTIFIER:
+	case TOKEN_INTEGER:
+	case TOKEN_FLOAT:
+	case TOKEN_STRING:
+	case TOKEN_CHAR:
+	case TOKEN_TRUE:
+	case TOKEN_FALSE:
+	case TOKEN_LPAREN:
+	case TOKEN_BANG:
+		return true;
+	case TOKEN_MINUS:
+	case TOKEN_STAR:
+	case TOKEN_AND:
+		return builtin_type(lexer_peek(p->lexer, 1));
+	default:
+		return false;
 	}
+}
 
-	/*
-	 * If after parsing an expression a `++` or a `--`
-	 * token is found, it should be a postfix expression.
-	 */
-	if (match(p, TOKEN_PLUS_PLUS) || match(p, TOKEN_MINUS_MINUS))
-	{
-		unary_op op;
-		switch (p->previous->type)
-		{
-		case TOKEN_PLUS_PLUS:
-			op = UOP_INCR;
-			break;
-		case TOKEN_MINUS_MINUS:
-			op = UOP_DECR;
-			break;
-		default:
-			break;
-		}
-
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_POSTFIX;
-		node->position = p->previous->position;
-		node->expr.unary.operator = op;
-		node->expr.unary.right = left;
-
-		return node;
+static void push_frame(parser *p, u8 kind, u8 power, int op, node_id node, u32 offset)
+{
+	if (p->frames_len == p->frames_cap) {
+		p->frames_cap = p->frames_cap ? p->frames_cap * 2 : 64;
+		p->frames = realloc(p->frames, p->frames_cap * sizeof(expr_frame));
 	}
+	p->frames[p->frames_len++] = (expr_frame){ kind, power, op, offset, node };
+}
 
-	if (match(p, TOKEN_DOT)) {
-		if (match(p, TOKEN_LCURLY)) {
-			ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-			node->type = NODE_STRUCT_INIT;
-			node->position = p->previous->position;
+/* Pop the operator on top of the stack and apply it to `right`. */
+static node_id reduce(parser *p, node_id right)
+{
+	expr_frame f = p->frames[--p->frames_len];
+	switch (f.kind) {
+	case FRAME_BINARY:
+		return add_binary(p, NODE_BINARY, f.offset, f.node, right, f.op);
+	case FRAME_UNARY:
+		return add_unary(p, NODE_UNARY, f.offset, right, f.op);
+	default:
+		return add_binary(p, NODE_CAST, f.offset, right, f.node, 0);
+	}
+}
 
-			if (match(p, TOKEN_RCURLY))
-			{
-				node->expr.struct_init.members = NULL;
-				return node;
+/*
+ * Operator precedence parsing with an explicit stack: operands are read
+ * in a loop and the operators before them wait in `p->frames` until one
+ * that binds looser, a closing parenthesis or the end of the expression
+ * comes. However long the chain of operators or deep the parentheses,
+ * the C stack doesn't grow.
+ */
+node_id parse_expression(parser *p)
+{
+	usize base = p->frames_len;
+	node_id operand;
+	unary_op uop;
+
+	for (;;) {
+		/* Prefix operators, casts and parentheses before an operand. */
+		for (;;) {
+			if (prefix_op(peek_type(p, 0), &uop)) {
+				advance(p);
+				push_frame(p, FRAME_UNARY, PREC_PREFIX, uop, 0, p->previous.offset);
+			} else if (match_peek(p, TOKEN_LPAREN) && peek_type(p, 1) == TOKEN_IDENTIFIER && peek_type(p, 2) == TOKEN_RPAREN
+					&& starts_operand(p)) {
+				advance(p);
+				u32 offset = p->previous.offset;
+				node_id type = parse_type(p);
+				advance(p);
+				push_frame(p, FRAME_CAST, PREC_PREFIX, 0, type, offset);
+			} else if (match(p, TOKEN_LPAREN)) {
+				push_frame(p, FRAME_PAREN, PREC_NONE, 0, 0, p->previous.offset);
+			} else {
+				break;
 			}
+		}
 
-			snapshot arena_start = arena_snapshot(p->allocator);
-			node->expr.struct_init.members = arena_alloc(p->allocator, sizeof(ast_node));
-			node->expr.struct_init.members->type = NODE_UNIT;
-			node->expr.struct_init.members->expr.unit_node.expr = parse_expression(p);
-			ast_node *tail = node->expr.struct_init.members;
-			node->expr.struct_init.members_len = 1;
-
-			/* In this case, there is only one parameter */
-			if (match(p, TOKEN_RCURLY))
-			{
-				return node;
-			}
+		operand = parse_factor(p);
+		if (operand) {
+			operand = parse_postfix(p, operand);
+		} else if (p->frames_len > base) {
+			error(p, "expected expression.");
+		}
+		if (!operand) {
+			p->frames_len = base;
+			return 0;
+		}
 
-			if (match(p, TOKEN_COMMA))
-			{
-				ast_node *expr = parse_expression(p);
-				if (expr)
-				{
-					while (!match(p, TOKEN_RCURLY))
-					{
-						if (!match(p, TOKEN_COMMA))
-						{
-							error(p, "expected `}`.");
-							arena_reset_to_snapshot(p->allocator, arena_start);
-							return NULL;
-						}
-						tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-						tail->expr.unit_node.next->expr.unit_node.expr = expr;
-						tail = tail->expr.unit_node.next;
-						tail->type = NODE_UNIT;
-						expr = parse_expression(p);
-						if (!expr)
-						{
-							error(p, "expected `}`.");
-							arena_reset_to_snapshot(p->allocator, arena_start);
-							return NULL;
-						}
-						node->expr.struct_init.members_len += 1;
-					}
-
-					tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-					tail->expr.unit_node.next->expr.unit_node.expr = expr;
-					tail = tail->expr.unit_node.next;
-					tail->type = NODE_UNIT;
+		token_type next = peek_type(p, 0);
+		u8 power = binary_ops[next].power;
+		while (p->frames_len > base) {
+			expr_frame *top = &p->frames[p->frames_len - 1];
+			if (top->kind == FRAME_PAREN) {
+				if (next != TOKEN_RPAREN) break;
+				advance(p);
+				p->frames_len -= 1;
+				operand = parse_postfix(p, operand);
+				if (!operand) {
+					p->frames_len = base;
+					return 0;
 				}
-				else
-				{
-					error(p, "expected member initialization.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-			}
-			else
-			{
-				error(p, "expected `}`.");
-				arena_reset_to_snapshot(p->allocator, arena_start);
-				return NULL;
+				next = peek_type(p, 0);
+				power = binary_ops[next].power;
+				continue;
 			}
-
-			return node;
-		} else {
-			error(p, "unexpected `.`");
-			return NULL;
+			if (top->power < power || (top->power == power && power == PREC_ASSIGN)) break;
+			operand = reduce(p, operand);
 		}
-	}
 
-	if (p->tokens && ((p->tokens->type >= TOKEN_DOUBLE_EQ && p->tokens->type <= TOKEN_NOT_EQ) || (p->tokens->type >= TOKEN_LSHIFT_EQ && p->tokens->type <= TOKEN_DOUBLE_AND)))
-	{
-		binary_op op;
-		switch (p->tokens->type)
-		{
-		case TOKEN_EQ:
-			op = OP_ASSIGN;
-			break;
-		case TOKEN_DOUBLE_EQ:
-			op = OP_EQ;
-			break;
-		case TOKEN_LESS_THAN:
-			op = OP_LT;
-			break;
-		case TOKEN_GREATER_THAN:
-			op = OP_GT;
-			break;
-		case TOKEN_LESS_EQ:
-			op = OP_LE;
-			break;
-		case TOKEN_GREATER_EQ:
-			op = OP_GE;
-			break;
-		case TOKEN_NOT_EQ:
-			op = OP_NEQ;
-			break;
-		case TOKEN_LSHIFT_EQ:
-			op = OP_LSHIFT_EQ;
-			break;
-		case TOKEN_RSHIFT_EQ:
-			op = OP_RSHIFT_EQ;
-			break;
-		case TOKEN_OR:
-			op = OP_OR;
-			break;
-		case TOKEN_DOUBLE_AND:
-			op = OP_AND;
-			break;
-		default:
-			break;
+		if (!power) {
+			if (p->frames_len > base) {
+				error(p, "unclosed parenthesis.");
+				p->frames_len = base;
+				return 0;
+			}
+			return operand;
 		}
 		advance(p);
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_BINARY;
-		node->position = p->previous->position;
-		node->expr.binary.left = left;
-		node->expr.binary.operator = op;
-		node->expr.binary.right = parse_expression(p);
-		if (!node->expr.binary.right) {
-			error(p, "expected expression.");
-			return NULL;
-		}
-
-		return node;
+		push_frame(p, FRAME_BINARY, power, binary_ops[next].op, operand, p->previous.offset);
 	}
-
-	return left;
 }
 
-static ast_node *parse_compound(parser *p)
+static node_id parse_compound(parser *p)
 {
 	if (!match(p, TOKEN_LCURLY)) {
 		error(p, "expected `{`.");
-		return NULL;
+		return 0;
 	}
 
-	ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-	node->type = NODE_UNIT;
-	node->position = p->previous->position;
-
+	u32 offset = p->previous.offset;
+	usize base = arrlen(p->scratch);
 	if (match(p, TOKEN_RCURLY))
 	{
-		node->expr.unit_node.expr = NULL;
-		node->expr.unit_node.next = NULL;
-		return node;
+		return add_list(p, NODE_UNIT, offset, base);
 	}
 
-	snapshot arena_start = arena_snapshot(p->allocator);
-	node->expr.unit_node.expr = parse_statement(p);
-	ast_node *tail = node;
-
-	/* In this case, there is only one parameter */
+	node_id expr = parse_statement(p);
+	if (expr)
+	{
+		arrput(p->scratch, expr);
+	}
 	if (match(p, TOKEN_RCURLY))
 	{
-		return node;
+		return add_list(p, NODE_UNIT, offset, base);
 	}
 
-	ast_node *expr = parse_statement(p);
-	if (expr)
+	expr = parse_statement(p);
+	if (!expr)
 	{
-		while (!match(p, TOKEN_RCURLY))
+		return add_list(p, NODE_UNIT, offset, base);
+	}
+	arrput(p->scratch, expr);
+	while (!match(p, TOKEN_RCURLY))
+	{
+		expr = parse_statement(p);
+		if (!expr)
 		{
-			tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-			tail->expr.unit_node.next->expr.unit_node.expr = expr;
-			tail = tail->expr.unit_node.next;
-			tail->type = NODE_UNIT;
-			expr = parse_statement(p);
-			if (!expr)
-			{
-				error(p, "expected `}`.");
-				arena_reset_to_snapshot(p->allocator, arena_start);
-				return NULL;
-			}
+			error(p, "expected `}`.");
+			arrsetlen(p->scratch, base);
+			return 0;
 		}
-
-		tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-		tail->expr.unit_node.next->expr.unit_node.expr = expr;
-		tail = tail->expr.unit_node.next;
-		tail->type = NODE_UNIT;
+		arrput(p->scratch, expr);
 	}
 
-	return node;
+	return add_list(p, NODE_UNIT, offset, base);
 }
 
-static ast_node *parse_for(parser *p)
+/*
+ * Parse the `|a, b|` captures of a for loop, the identifiers are left
+ * on the scratch stack.
+ */
+static bool parse_captures(parser *p)
 {
-	advance(p);
-	ast_node* node = arena_alloc(p->allocator, sizeof(ast_node));
-	node->type = NODE_FOR;
-	node->position = p->previous->position;
-
-	snapshot arena_start = arena_snapshot(p->allocator);
-	node->expr.fr.slices = arena_alloc(p->allocator, sizeof(ast_node));
-	node->expr.fr.slices->type = NODE_UNIT;
-	node->expr.fr.slices->expr.unit_node.expr = parse_expression(p);
-	ast_node *tail = node->expr.fr.slices;
-	node->expr.fr.slice_len = 1;
-
-	/* In this case, there is only one slice. */
-	if (match(p, TOKEN_RPAREN))
-	{
-		goto parse_captures;
+	if (!match(p, TOKEN_PIPE)) {
+		error(p, "expected capture.");
+		return false;
 	}
 
-	if (match(p, TOKEN_COMMA))
-	{
-		ast_node *expr = parse_expression(p);
-		if (expr)
-		{
-			while (!match(p, TOKEN_RPAREN))
-			{
-				if (!match(p, TOKEN_COMMA))
-				{
-					error(p, "expected `)`.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-				tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-				tail->expr.unit_node.next->expr.unit_node.expr = expr;
-				tail = tail->expr.unit_node.next;
-				tail->type = NODE_UNIT;
-				expr = parse_expression(p);
-				if (!expr)
-				{
-					error(p, "expected `)`.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-			}
-
-			tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-			tail->expr.unit_node.next->expr.unit_node.expr = expr;
-			tail = tail->expr.unit_node.next;
-			node->expr.fr.slice_len += 1;
-			tail->type = NODE_UNIT;
+	do {
+		node_id capture = parse_factor(p);
+		if (!capture) {
+			error(p, "expected identifier.");
+			return false;
 		}
-		else
-		{
-			error(p, "expected expression.");
-			arena_reset_to_snapshot(p->allocator, arena_start);
-			return NULL;
+		if (p->ast->kinds[capture] != NODE_IDENTIFIER) {
+			error(p, "captures must be identifiers.");
+			return false;
 		}
-	}
-	else
-	{
-		error(p, "expected `)`.");
-		arena_reset_to_snapshot(p->allocator, arena_start);
-		return NULL;
-	}
-
-parse_captures:
+		arrput(p->scratch, capture);
+	} while (match(p, TOKEN_COMMA));
 
 	if (!match(p, TOKEN_PIPE)) {
-		error(p, "expected capture.");
-		return NULL;
+		error(p, "expected `|`.");
+		return false;
 	}
+	return true;
+}
 
-	arena_start = arena_snapshot(p->allocator);
-	node->expr.fr.captures = arena_alloc(p->allocator, sizeof(ast_node));
-	node->expr.fr.captures->type = NODE_UNIT;
-	node->expr.fr.captures->expr.unit_node.expr = parse_factor(p);
-	if (node->expr.fr.captures->expr.unit_node.expr && node->expr.fr.captures->expr.unit_node.expr->type != NODE_IDENTIFIER) {
-		error(p, "captures must be identifiers.");
-		arena_reset_to_snapshot(p->allocator, arena_start);
-		return NULL;
-	}
-	tail = node->expr.fr.captures;
-	node->expr.fr.capture_len = 1;
+static node_id parse_for(parser *p)
+{
+	advance(p);
+	u32 offset = p->previous.offset;
 
-	/* In this case, there is only one capture */
-	if (match(p, TOKEN_PIPE)) {
-		goto parse_body;
+	ast_for fr;
+	usize base = arrlen(p->scratch);
+	if (!parse_list(p, TOKEN_RPAREN, "expected `)`.")) {
+		arrsetlen(p->scratch, base);
+		return 0;
+	}
+	fr.slices = flush_list(p, base, &fr.slice_len);
+	if (!parse_captures(p)) {
+		arrsetlen(p->scratch, base);
+		return 0;
+	}
+	fr.captures = flush_list(p, base, &fr.capture_len);
+	if (fr.capture_len != fr.slice_len) {
+		error(p, "invalid number of captures.");
+		return 0;
 	}
 
-	if (match(p, TOKEN_COMMA)) {
-		ast_node *expr = parse_expression(p);
-		if (expr) {
-			while (!match(p, TOKEN_PIPE)) {
-				if (!match(p, TOKEN_COMMA)) {
-					error(p, "expected `)`.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-				tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-				tail->expr.unit_node.next->expr.unit_node.expr = expr;
-				tail = tail->expr.unit_node.next;
-				tail->type = NODE_UNIT;
-				expr = parse_factor(p);
-				if (!expr) {
-					error(p, "expected `|`.");
-					arena_reset_to_snapshot(p->allocator, arena_start);
-					return NULL;
-				}
-			}
-
-			tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-			tail->expr.unit_node.next->expr.unit_node.expr = expr;
-			tail = tail->expr.unit_node.next;
-			tail->type = NODE_UNIT;
-			node->expr.fr.capture_len += 1;
-		} else {
-			error(p, "expected identifier.");
-			arena_reset_to_snapshot(p->allocator, arena_start);
-			return NULL;
-		}
-	} else {
-		error(p, "expected `|`.");
-		arena_reset_to_snapshot(p->allocator, arena_start);
-		return NULL;
-	}
-
-parse_body:;
-	if (node->expr.fr.capture_len != node->expr.fr.slice_len) {
-		error(p, "invalid number of captures.");
-		return NULL;
-	}
-
-	ast_node* body = parse_compound(p);
-	node->expr.fr.body = body;
-	return node;
+	fr.body = parse_compound(p);
+	arrput(p->ast->fors, fr);
+	return add_node(p, NODE_FOR, offset, arrlen(p->ast->fors) - 1);
 }
 
-static ast_node *parse_while(parser *p)
+static node_id parse_while(parser *p)
 {
 	u8 flags = 0x0;
 
@@ -818,17 +662,14 @@ static ast_node *parse_while(parser *p)
 		flags |= LOOP_UNTIL;
 	} else if (!match_peek(p, TOKEN_LCURLY)) {
 		error(p, "expected `while`, `until` or `{`.");
-		return NULL;
+		return 0;
 	}
-	ast_node *condition = parse_expression(p);
+	node_id condition = parse_expression(p);
 	if (!condition) {
 		flags |= LOOP_AFTER;
 	}
-	ast_node *body = parse_compound(p);
-	ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-	node->type = NODE_WHILE;
-	node->position = p->previous->position;
-	node->expr.whle.body = body;
+	node_id body = parse_compound(p);
+	u32 offset = p->previous.offset;
 
 	if (flags & LOOP_AFTER) {
 		if (match(p, TOKEN_WHILE)) {
@@ -837,65 +678,60 @@ static ast_node *parse_while(parser *p)
 		} else if (match(p, TOKEN_UNTIL)) {
 			flags |= LOOP_UNTIL;
 			condition = parse_expression(p);
-		} else {
-			node->expr.whle.condition = NULL;
 		}
 	}
-	
-	node->expr.whle.condition = condition;
 
-	return node;
+	ast_loop loop = { condition, body, flags };
+	arrput(p->ast->loops, loop);
+	return add_node(p, NODE_WHILE, offset, arrlen(p->ast->loops) - 1);
 }
 
-static ast_node *parse_if(parser *p)
+static node_id parse_if(parser *p)
 {
-	ast_node *condition = parse_expression(p);
-	ast_node *body = parse_compound(p);
-	ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-	node->type = NODE_IF;
-	node->position = p->previous->position;
-	node->expr.whle.body = body;
-	node->expr.whle.condition = condition;
-	return node;
+	node_id condition = parse_expression(p);
+	node_id body = parse_compound(p);
+	ast_loop loop = { condition, body, 0 };
+	arrput(p->ast->loops, loop);
+	return add_node(p, NODE_IF, p->previous.offset, arrlen(p->ast->loops) - 1);
 }
 
-static ast_node *parse_struct(parser *p);
-static ast_node *parse_type(parser *p)
+static node_id parse_struct(parser *p);
+static node_id parse_type(parser *p)
 {
-	ast_node *type = NULL;
-	
+	node_id type = 0;
+
 	if (match(p, TOKEN_STRUCT)) {
 		type = parse_struct(p);
 	} else if (match(p, TOKEN_UNION)) {
 		type = parse_struct(p);
-		type->type = NODE_UNION;
+		if (type) p->ast->kinds[type] = NODE_UNION;
 	} else if (match(p, TOKEN_LSQUARE)) {
 		/* Array/slice type */
-		type = arena_alloc(p->allocator, sizeof(ast_node));
-		type->type = NODE_PTR_TYPE;
-		if (match(p, TOKEN_CONST)) type->expr.ptr_type.flags |= PTR_CONST;
-		if (match(p, TOKEN_VOLATILE)) type->expr.ptr_type.flags |= PTR_VOLATILE;
-		type->expr.ptr_type.flags |= PTR_SLICE;
-		type->expr.ptr_type.type = parse_type(p);
-		if (!type->expr.ptr_type.type) {
+		u32 offset = p->previous.offset;
+		u32 flags = PTR_SLICE;
+		if (match(p, TOKEN_CONST)) flags |= PTR_CONST;
+		if (match(p, TOKEN_VOLATILE)) flags |= PTR_VOLATILE;
+		node_id child = parse_type(p);
+		if (!child) {
 			error(p, "expected type.");
-			return NULL;
+			return 0;
 		}
 		if (!match(p, TOKEN_RSQUARE)) {
 			error(p, "expected `]`.");
-			return NULL;
+			return 0;
 		}
+		type = add_unary(p, NODE_PTR_TYPE, offset, child, flags);
 	} else if (match(p, TOKEN_STAR)) {
-		type = arena_alloc(p->allocator, sizeof(ast_node));
-		type->type = NODE_PTR_TYPE;
-		if (match(p, TOKEN_CONST)) type->expr.ptr_type.flags |= PTR_CONST;
-		if (match(p, TOKEN_VOLATILE)) type->expr.ptr_type.flags |= PTR_VOLATILE;
-		type->expr.ptr_type.flags |= PTR_RAW;
-		type->expr.ptr_type.type = parse_type(p);
-		if (!type->expr.ptr_type.type) {
+		u32 offset = p->previous.offset;
+		u32 flags = PTR_RAW;
+		if (match(p, TOKEN_CONST)) flags |= PTR_CONST;
+		if (match(p, TOKEN_VOLATILE)) flags |= PTR_VOLATILE;
+		node_id child = parse_type(p);
+		if (!child) {
 			error(p, "expected type.");
-			return NULL;
+			return 0;
 		}
+		type = add_unary(p, NODE_PTR_TYPE, offset, child, flags);
 	} else if (match_peek(p, TOKEN_IDENTIFIER)) {
 		type = parse_factor(p);
 	}
@@ -903,430 +739,2098 @@ static ast_node *parse_type(parser *p)
 	return type;
 }
 
-static member *parse_member(parser *p)
+/* Returns the index of the new entry in `members`, 0 on errors. */
+static u32 parse_member(parser *p)
 {
-	ast_node *type = parse_type(p);
-	
+	node_id type = parse_type(p);
+
 	if (!match_peek(p, TOKEN_IDENTIFIER)) {
 		error(p, "expected identifier.");
-		return NULL;
+		return 0;
 	}
 
-	member *m = arena_alloc(p->allocator, sizeof(member));
-	m->type = type;
-	m->name = peek(p)->lexeme;
-	m->name_len = peek(p)->lexeme_len;
+	member m = { type, peek(p).symbol, 0, 0 };
 	advance(p);
-
-
-	return m;
+	arrput(p->ast->members, m);
+	return arrlen(p->ast->members) - 1;
 }
 
-static variant *parse_variant(parser *p)
+/* Returns the index of the new entry in `variants`, 0 on errors. */
+static u32 parse_variant(parser *p)
 {
 	if (!match_peek(p, TOKEN_IDENTIFIER)) {
 		error(p, "expected identifier.");
-		return NULL;
+		return 0;
 	}
 
-	variant *v = arena_alloc(p->allocator, sizeof(variant));
-	v->name = peek(p)->lexeme;
-	v->name_len = peek(p)->lexeme_len;
+	variant v = { 0, peek(p).symbol, 0 };
 	advance(p);
 
 	if (match(p, TOKEN_EQ)) {
-		v->value = parse_factor(p);
-		if (!v->value) {
+		v.value = parse_factor(p);
+		if (!v.value) {
 			error(p, "expected integer.");
-			return NULL;
+			return 0;
 		}
 
-		if (v->value->type != NODE_INTEGER) {
+		if (p->ast->kinds[v.value] != NODE_INTEGER) {
 			error(p, "expected integer.");
-			return NULL;
+			return 0;
 		}
 	}
 
-	return v;
+	arrput(p->ast->variants, v);
+	return arrlen(p->ast->variants) - 1;
 }
 
-static ast_node *parse_enum(parser *p)
+/*
+ * Parse the name and the opening `{` of a struct, union or enum. The
+ * name is 0 for anonymous ones.
+ */
+static bool parse_aggregate_name(parser *p, u32 *symbol)
 {
-	ast_node *enm = arena_alloc(p->allocator, sizeof(ast_node));
-	enm->type = NODE_ENUM;
-	enm->position = p->previous->position;
+	*symbol = 0;
 	if (match_peek(p, TOKEN_IDENTIFIER)) {
-		/* Named enum */
-		enm->expr.enm.name = peek(p)->lexeme;
-		enm->expr.enm.name_len = peek(p)->lexeme_len;
+		*symbol = peek(p).symbol;
 		advance(p);
 	} else if (!match_peek(p, TOKEN_LCURLY)) {
 		error(p, "expected identifier or `{`.");
-		return NULL;
-	} else {
-		enm->expr.enm.name = NULL;
-		enm->expr.enm.name_len = 0;
+		return false;
 	}
 
 	if (!match(p, TOKEN_LCURLY)) {
 		error(p, "expected `{`.");
-		return NULL;
+		return false;
+	}
+	return true;
+}
+
+static node_id parse_enum(parser *p)
+{
+	u32 offset = p->previous.offset;
+	ast_aggregate enm;
+	if (!parse_aggregate_name(p, &enm.symbol)) {
+		return 0;
 	}
 
-	variant *prev = parse_variant(p);
-	variant *head = prev;
-	enm->expr.enm.variants = head;
+	u32 prev = parse_variant(p);
+	enm.first = prev;
 	if (!prev) {
 		error(p, "invalid enum definition. Enums should contain at least 1 variant.");
-		return NULL;
+		return 0;
 	}
-	if (!match(p, TOKEN_COMMA)) {
-		if (!match(p, TOKEN_RCURLY)) {
-			error(p, "expected `,`.");
-			return NULL;
-		} else {
-			return enm;
-		}
+	if (!match(p, TOKEN_COMMA) && !match_peek(p, TOKEN_RCURLY)) {
+		error(p, "expected `,`.");
+		return 0;
 	}
 	while (!match(p, TOKEN_RCURLY)) {
-		variant *current = parse_variant(p);
+		u32 current = parse_variant(p);
 		if (!current) {
 			error(p, "expected variant definition.");
-			return NULL;
+			return 0;
 		}
-		prev->next = current;
+		p->ast->variants[prev].next = current;
 		if (!match(p, TOKEN_COMMA)) {
 			if (!match_peek(p, TOKEN_RCURLY)) {
 				error(p, "expected `,`.");
-				return NULL;
+				return 0;
 			}
 		}
 
 		prev = current;
 	}
 
-	return enm;
+	arrput(p->ast->aggregates, enm);
+	return add_node(p, NODE_ENUM, offset, arrlen(p->ast->aggregates) - 1);
 }
 
-static ast_node *parse_struct(parser *p)
+static node_id parse_struct(parser *p)
 {
-	ast_node *structure = arena_alloc(p->allocator, sizeof(ast_node));
-	structure->type = NODE_STRUCT;
-	structure->position = p->previous->position;
-	if (match_peek(p, TOKEN_IDENTIFIER)) {
-		/* Named structure */
-		structure->expr.structure.name = peek(p)->lexeme;
-		structure->expr.structure.name_len = peek(p)->lexeme_len;
-		advance(p);
-	} else if (!match_peek(p, TOKEN_LCURLY)) {
-		error(p, "expected identifier or `{`.");
-		return NULL;
-	} else {
-		structure->expr.structure.name = NULL;
-		structure->expr.structure.name_len = 0;
-	}
-
-	if (!match(p, TOKEN_LCURLY)) {
-		error(p, "expected `{`.");
-		return NULL;
+	u32 offset = p->previous.offset;
+	ast_aggregate structure;
+	if (!parse_aggregate_name(p, &structure.symbol)) {
+		return 0;
 	}
 
-	member *prev = parse_member(p);
-	member *head = prev;
-	structure->expr.structure.members = head;
+	u32 prev = parse_member(p);
+	structure.first = prev;
 	if (!prev) {
 		error(p, "invalid struct definition. Structs should contain at least 1 member.");
-		return NULL;
+		return 0;
 	}
-	if (!match(p, TOKEN_COMMA)) {
-		if (!match(p, TOKEN_RCURLY)) {
-			error(p, "expected `,`.");
-			return NULL;
-		} else {
-			return structure;
-		}
+	if (!match(p, TOKEN_COMMA) && !match_peek(p, TOKEN_RCURLY)) {
+		error(p, "expected `,`.");
+		return 0;
 	}
 	while (!match(p, TOKEN_RCURLY)) {
-		member *current = parse_member(p);
+		u32 current = parse_member(p);
 		if (!current) {
 			error(p, "expected member definition.");
-			return NULL;
+			return 0;
 		}
-		prev->next = current;
+		p->ast->members[prev].next = current;
 		if (!match(p, TOKEN_COMMA)) {
 			if (!match_peek(p, TOKEN_RCURLY)) {
 				error(p, "expected `,`.");
-				return NULL;
+				return 0;
 			}
 		}
 
 		prev = current;
 	}
 
-	return structure;
+	arrput(p->ast->aggregates, structure);
+	return add_node(p, NODE_STRUCT, offset, arrlen(p->ast->aggregates) - 1);
+}
+
+/*
+ * Move the cursor past the `}` matching the `{` under it. Returns false,
+ * without moving, when it is never closed.
+ */
+static bool skip_body(parser *p)
+{
+	token_list *t = &p->lexer->tokens;
+	usize depth = 0;
+	for (usize i = p->lexer->cursor; i < t->len; i++) {
+		if (t->types[i] == TOKEN_LCURLY) {
+			depth += 1;
+		} else if (t->types[i] == TOKEN_RCURLY && --depth == 0) {
+			p->lexer->cursor = i;
+			advance(p);
+			return true;
+		}
+	}
+	return false;
 }
 
-static ast_node *parse_function(parser *p)
+static node_id parse_function(parser *p)
 {
-	ast_node *fn = arena_alloc(p->allocator, sizeof(ast_node));
-	fn->type = NODE_FUNCTION;
-	fn->expr.function.type = parse_type(p);
-	fn->expr.function.name = peek(p)->lexeme;
-	fn->expr.function.name_len = peek(p)->lexeme_len;
+	ast_function fn = { 0 };
+	fn.type = parse_type(p);
+	fn.symbol = peek(p).symbol;
+	u32 offset = peek(p).offset;
 	advance(p);
 	/* Consume `(` */
 	advance(p);
 
-	if (match(p, TOKEN_RPAREN)) {
-		fn->expr.function.body = parse_compound(p);;
-		fn->expr.function.parameters = NULL;
-		fn->expr.function.parameters_len = 0;
-		return fn;
-	}
-	member *prev = parse_member(p);
-	member *head = prev;
-	fn->expr.function.parameters = head;
-	fn->expr.function.parameters_len = 1;
-	if (!match(p, TOKEN_COMMA)) {
-		if (!match(p, TOKEN_RPAREN)) {
+	if (!match(p, TOKEN_RPAREN)) {
+		u32 prev = parse_member(p);
+		fn.params = prev;
+		fn.param_len = 1;
+		if (!match(p, TOKEN_COMMA) && !match_peek(p, TOKEN_RPAREN)) {
 			error(p, "expected `,`.");
-			return NULL;
-		} else {
-			fn->expr.function.body = parse_compound(p);
-			return fn;
-		}
-	}
-	while (!match(p, TOKEN_RPAREN)) {
-		member *current = parse_member(p);
-		if (!current) {
-			error(p, "expected parameter.");
-			return NULL;
+			return 0;
 		}
-		prev->next = current;
-		if (!match(p, TOKEN_COMMA)) {
-			if (!match_peek(p, TOKEN_RPAREN)) {
-				error(p, "expected `,`.");
-				return NULL;
+		while (!match(p, TOKEN_RPAREN)) {
+			u32 current = parse_member(p);
+			if (!current) {
+				error(p, "expected parameter.");
+				return 0;
 			}
-		}
-		fn->expr.function.parameters_len += 1;
+			p->ast->members[prev].next = current;
+			if (!match(p, TOKEN_COMMA)) {
+				if (!match_peek(p, TOKEN_RPAREN)) {
+					error(p, "expected `,`.");
+					return 0;
+				}
+			}
+			fn.param_len += 1;
 
-		prev = current;
+			prev = current;
+		}
+	}
+	if (p->lazy && match_peek(p, TOKEN_LCURLY)) {
+		fn.lazy = p->lexer->cursor;
+		if (!skip_body(p)) {
+			fn.lazy = 0;
+		}
+	}
+	if (!fn.lazy) {
+		/* A nested function can't be found again, it is parsed with the body. */
+		bool lazy = p->lazy;
+		p->lazy = false;
+		fn.body = parse_compound(p);
+		p->lazy = lazy;
 	}
-	fn->expr.function.body = parse_compound(p);
 
-	return fn;
+	arrput(p->ast->functions, fn);
+	return add_node(p, NODE_FUNCTION, offset, arrlen(p->ast->functions) - 1);
 }
 
-static ast_node *parse_statement(parser *p)
+/*
+ * Number of tokens of the type `n` tokens past the cursor, 0 if there
+ * is none. Only the shape is looked at, `parse_type()` reports errors.
+ */
+static usize type_len(parser *p, usize n)
 {
-	token *cur = peek(p);
-	ast_node *type = parse_type(p);
-	if (type && type->type == NODE_STRUCT && type->expr.structure.name_len > 0) {
-		goto skip_struct;
+	usize start = n;
+	token_type first = peek_type(p, n);
+	switch (first) {
+	case TOKEN_IDENTIFIER:
+		return 1;
+	case TOKEN_LSQUARE:
+	case TOKEN_STAR: {
+		n += 1;
+		if (peek_type(p, n) == TOKEN_CONST) n += 1;
+		if (peek_type(p, n) == TOKEN_VOLATILE) n += 1;
+		usize child = type_len(p, n);
+		if (!child) return 0;
+		n += child;
+		if (first == TOKEN_LSQUARE && peek_type(p, n++) != TOKEN_RSQUARE) return 0;
+		return n - start;
+	}
+	case TOKEN_STRUCT:
+	case TOKEN_UNION: {
+		n += 1;
+		if (peek_type(p, n) == TOKEN_IDENTIFIER) n += 1;
+		if (peek_type(p, n) != TOKEN_LCURLY) return 0;
+		usize depth = 0;
+		do {
+			token_type t = peek_type(p, n++);
+			if (t == TOKEN_END) return 0;
+			if (t == TOKEN_LCURLY) depth += 1;
+			if (t == TOKEN_RCURLY) depth -= 1;
+		} while (depth);
+		return n - start;
+	}
+	default:
+		return 0;
 	}
-	if (type && match_peek(p, TOKEN_IDENTIFIER)) {
-		if (p->tokens->next && p->tokens->next->type == TOKEN_LPAREN) {
-			/* Function definition. */
-			p->tokens = cur;
-			return parse_function(p);
-		}
-		p->tokens = cur;
-		/* Variable declaration. */
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_VAR_DECL;
-		node->position = p->previous->position;
-		node->expr.var_decl.type = parse_type(p);
-		node->expr.var_decl.name = p->tokens->lexeme;
-		node->expr.var_decl.name_len = p->tokens->lexeme_len;
-		advance(p);
-		if (match(p, TOKEN_EQ)) {
-			node->expr.var_decl.value = parse_expression(p);
-		} else {
-			node->expr.var_decl.value = NULL;
-		}
+}
 
-		if (!match(p, TOKEN_SEMICOLON)) {
-			error(p, "expected `;` after statement.");
-			return NULL;
+typedef enum {
+	STMT_EXPRESSION,
+	STMT_FUNCTION,
+	STMT_VAR_DECL,
+	STMT_STRUCT,
+	STMT_UNION,
+	STMT_ENUM,
+	STMT_LABEL,
+	STMT_GOTO,
+	STMT_BREAK,
+	STMT_RETURN,
+	STMT_IMPORT,
+	STMT_LOOP,
+	STMT_IF,
+} statement_kind;
+
+/* Stands for all the tokens of a type in `statements`. */
+#define ANY_TYPE 0xff
+
+/*
+ * How each kind of statement starts. The first pattern matching the
+ * tokens under the cursor picks the production, a statement that
+ * matches none is an expression.
+ */
+static const struct {
+	u8 len;
+	u8 tokens[3];
+	u8 kind;
+} statements[] = {
+	/* Named aggregates are declarations, whatever follows them. */
+	{ 2, { TOKEN_STRUCT, TOKEN_IDENTIFIER }, STMT_STRUCT },
+	{ 2, { TOKEN_UNION, TOKEN_IDENTIFIER }, STMT_UNION },
+	{ 3, { ANY_TYPE, TOKEN_IDENTIFIER, TOKEN_LPAREN }, STMT_FUNCTION },
+	{ 2, { ANY_TYPE, TOKEN_IDENTIFIER }, STMT_VAR_DECL },
+	/* Only a type starts with `[`, let `parse_type()` report what is wrong. */
+	{ 1, { TOKEN_LSQUARE }, STMT_VAR_DECL },
+	{ 1, { TOKEN_STRUCT }, STMT_STRUCT },
+	{ 1, { TOKEN_UNION }, STMT_UNION },
+	{ 1, { TOKEN_ENUM }, STMT_ENUM },
+	{ 2, { TOKEN_IDENTIFIER, TOKEN_COLON }, STMT_LABEL },
+	{ 1, { TOKEN_GOTO }, STMT_GOTO },
+	{ 1, { TOKEN_BREAK }, STMT_BREAK },
+	{ 1, { TOKEN_RETURN }, STMT_RETURN },
+	{ 1, { TOKEN_IMPORT }, STMT_IMPORT },
+	{ 1, { TOKEN_LOOP }, STMT_LOOP },
+	{ 1, { TOKEN_IF }, STMT_IF },
+};
+
+/* Pick the production of the statement under the cursor, without consuming anything. */
+static statement_kind classify(parser *p, usize *type)
+{
+	*type = type_len(p, 0);
+	for (usize i = 0; i < sizeof(statements) / sizeof(*statements); i++) {
+		usize n = 0;
+		bool matched = true;
+		for (usize j = 0; matched && j < statements[i].len; j++) {
+			if (statements[i].tokens[j] == ANY_TYPE) {
+				matched = *type > 0;
+				n += *type;
+			} else {
+				matched = peek_type(p, n) == statements[i].tokens[j];
+				n += 1;
+			}
 		}
+		if (matched) {
+			return statements[i].kind;
+		}
+	}
+	return STMT_EXPRESSION;
+}
 
-		return node;
+static node_id parse_var_decl(parser *p, usize type)
+{
+	/* The node points at the last token of the type. */
+	u32 offset = type ? lexer_peek(p->lexer, type - 1).offset : peek(p).offset;
+	ast_decl decl = { 0 };
+	decl.type = parse_type(p);
+	if (!decl.type) {
+		/* Only a broken slice type gets here, `parse_type()` reported it. */
+		return 0;
+	}
+	if (!match_peek(p, TOKEN_IDENTIFIER)) {
+		error(p, "expected variable name.");
+		return 0;
+	}
+	decl.symbol = peek(p).symbol;
+	advance(p);
+	if (match(p, TOKEN_EQ)) {
+		decl.value = parse_expression(p);
 	}
-skip_struct:
-	p->tokens = cur;
 
-	if (match(p, TOKEN_BREAK))
-	{
-		if (!match(p, TOKEN_SEMICOLON))
-		{
-			error(p, "expected `;` after `break`.");
-			return NULL;
-		}
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_BREAK;
-		node->position = p->previous->position;
-		return node;
+	if (!match(p, TOKEN_SEMICOLON)) {
+		error(p, "expected `;` after statement.");
+		return 0;
 	}
-	else if (match(p, TOKEN_RETURN))
-	{
-		ast_node *expr = parse_expression(p);
 
-		if (!expr)
-		{
-			error(p, "expected expression after `return`.");
-			return NULL;
-		}
-		if (!match(p, TOKEN_SEMICOLON))
-		{
-			error(p, "expected `;`.");
-			return NULL;
-		}
+	arrput(p->ast->decls, decl);
+	return add_node(p, NODE_VAR_DECL, offset, arrlen(p->ast->decls) - 1);
+}
 
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_RETURN;
-		node->position = p->previous->position;
-		node->expr.ret.value = expr;
+static node_id parse_statement(parser *p)
+{
+	usize type;
+	node_id node;
+	/* `advance()` reports them. */
+	while (match(p, TOKEN_ERROR));
+	switch (classify(p, &type)) {
+	case STMT_FUNCTION:
+		return parse_function(p);
+	case STMT_VAR_DECL:
+		return parse_var_decl(p, type);
+	case STMT_STRUCT:
+		advance(p);
+		return parse_struct(p);
+	case STMT_UNION:
+		advance(p);
+		node = parse_struct(p);
+		if (node) p->ast->kinds[node] = NODE_UNION;
 		return node;
-	}
-	else if (match_peek(p, TOKEN_IDENTIFIER) && p->tokens->next && p->tokens->next->type == TOKEN_COLON)
-	{
-		/* In this case, this is a label. */
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_LABEL;
-		node->position = p->previous->position;
-		node->expr.label.name = p->tokens->lexeme;
-		node->expr.label.name_len = p->tokens->lexeme_len;
+	case STMT_ENUM:
+		advance(p);
+		return parse_enum(p);
+	case STMT_LABEL:
+		node = add_node(p, NODE_LABEL, peek(p).offset, peek(p).symbol);
 		advance(p);
 		/* Consume `:` */
 		advance(p);
 		return node;
-	}
-	else if (match(p, TOKEN_GOTO))
-	{
+	case STMT_GOTO:
+		advance(p);
 		if (!match_peek(p, TOKEN_IDENTIFIER))
 		{
 			error(p, "expected label identifier after `goto`.");
-			return NULL;
+			return 0;
 		}
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_GOTO;
-		node->position = p->previous->position;
-		node->expr.label.name = p->tokens->lexeme;
-		node->expr.label.name_len = p->tokens->lexeme_len;
+		node = add_node(p, NODE_GOTO, p->previous.offset, peek(p).symbol);
 		advance(p);
 		if (!match(p, TOKEN_SEMICOLON))
 		{
 			error(p, "expected `;` after `goto`.");
-			return NULL;
+			return 0;
 		}
 		return node;
-	}
-	else if (match(p, TOKEN_IMPORT))
-	{
-		ast_node *expr = parse_expression(p);
+	case STMT_BREAK:
+		advance(p);
+		if (!match(p, TOKEN_SEMICOLON))
+		{
+			error(p, "expected `;` after `break`.");
+			return 0;
+		}
+		return add_node(p, NODE_BREAK, p->previous.offset, 0);
+	case STMT_RETURN:
+		advance(p);
+		node = parse_expression(p);
+		if (!node)
+		{
+			error(p, "expected expression after `return`.");
+			return 0;
+		}
+		if (!match(p, TOKEN_SEMICOLON))
+		{
+			error(p, "expected `;`.");
+			return 0;
+		}
+		return add_node(p, NODE_RETURN, p->previous.offset, node);
+	case STMT_IMPORT: {
+		advance(p);
+		node_id expr = parse_expression(p);
 		if (!expr)
 		{
 			error(p, "expected module path after `import`.");
-			return NULL;
+			return 0;
 		}
-		if (expr->type != NODE_ACCESS && expr->type != NODE_IDENTIFIER)
+		if (p->ast->kinds[expr] != NODE_ACCESS && p->ast->kinds[expr] != NODE_IDENTIFIER)
 		{
 			error(p, "expected module path after `import`.");
-			return NULL;
+			return 0;
 		}
 
-		ast_node *node = arena_alloc(p->allocator, sizeof(ast_node));
-		node->type = NODE_IMPORT;
-		node->position = p->previous->position;
-		node->expr.import.path = expr;
+		node = add_node(p, NODE_IMPORT, p->previous.offset, expr);
 
 		if (!match(p, TOKEN_SEMICOLON))
 		{
 			error(p, "expected `;` after `import`.");
-			return NULL;
+			return 0;
 		}
-
 		return node;
 	}
-	else if (match(p, TOKEN_LOOP))
-	{
-		if (p->tokens->type == TOKEN_LPAREN)
+	case STMT_LOOP:
+		advance(p);
+		if (peek_type(p, 0) == TOKEN_LPAREN)
 		{
 			return parse_for(p);
 		}
-		else
-		{
-			return parse_while(p);
-		}
-	}
-	else if (match(p, TOKEN_IF)) {
+		return parse_while(p);
+	case STMT_IF:
+		advance(p);
 		return parse_if(p);
+	case STMT_EXPRESSION:
+		break;
 	}
-	else if (match(p, TOKEN_STRUCT))
-	{
-		return parse_struct(p);
-	}
-	else if (match(p, TOKEN_ENUM))
-	{
-		return parse_enum(p);
-	}
-	else if (match(p, TOKEN_UNION))
+
+	node = parse_expression(p);
+	if (!node)
 	{
-		ast_node *u = parse_struct(p);
-		u->type = NODE_UNION;
-		return u;
+		return 0;
 	}
-	else
+	if (!match(p, TOKEN_SEMICOLON))
 	{
-		ast_node *expr = parse_expression(p);
-		if (!expr)
-		{
-			return NULL;
-		}
-		if (!match(p, TOKEN_SEMICOLON))
-		{
-			error(p, "expected `;` after expression.");
-			return NULL;
-		}
-		return expr;
+		error(p, "expected `;` after expression.");
+		return 0;
 	}
+	return node;
+}
+
+static bool is_decl(node_type kind)
+{
+	return kind == NODE_FUNCTION || kind == NODE_VAR_DECL || kind == NODE_IMPORT ||
+		kind == NODE_STRUCT || kind == NODE_UNION || kind == NODE_ENUM;
+}
+
+/* Parse a top level statement, its nodes are relative to its first token. */
+static node_id parse_top(parser *p)
+{
+	p->base = peek(p).offset;
+	return parse_statement(p);
+}
+
+/* Put a top level declaration in the root, after the ones on the scratch stack. */
+static void add_top(parser *p, node_id decl)
+{
+	arrput(p->scratch, decl);
+	arrput(p->ast->bases, p->base);
 }
 
 /* Get a list of expressions to form a full AST. */
 static void parse(parser *p)
 {
-	p->ast = arena_alloc(p->allocator, sizeof(ast_node));
-	p->ast->type = NODE_UNIT;
-	p->ast->expr.unit_node.expr = parse_statement(p);
-	ast_node *tail = p->ast;
-	ast_node *expr = parse_statement(p);
+	node_id expr = parse_top(p);
+	if (expr) {
+		add_top(p, expr);
+	}
+	expr = parse_top(p);
 	while (expr) {
-		if (expr->type != NODE_FUNCTION && expr->type != NODE_VAR_DECL && expr->type != NODE_IMPORT &&
-			expr->type != NODE_STRUCT && expr->type != NODE_UNION && expr->type != NODE_ENUM) {
+		if (!is_decl(p->ast->kinds[expr])) {
 			error(p, "expected function, struct, enum, union, global variable or import statement.");
-			return;
+			break;
 		}
-		tail->expr.unit_node.next = arena_alloc(p->allocator, sizeof(ast_node));
-		tail->expr.unit_node.next->expr.unit_node.expr = expr;
-		tail = tail->expr.unit_node.next;
-		tail->type = NODE_UNIT;
-		expr = parse_statement(p);
+		add_top(p, expr);
+		expr = parse_top(p);
+	}
+	/* The parser gave up, the lexer's errors past that point are still reported. */
+	while (!match_peek(p, TOKEN_END)) {
+		advance(p);
 	}
+	p->base = 0;
+	p->root = add_list(p, NODE_UNIT, 0, 0);
 }
 
-parser *parser_init(lexer *l, arena *allocator)
+static parser *create(lexer *l, arena *allocator)
 {
 	parser *p = arena_alloc(allocator, sizeof(parser));
-	p->tokens = l->tokens;
+	p->lexer = l;
+	memset(&p->previous, 0x0, sizeof(token));
+	p->frames = NULL;
+	p->frames_len = 0;
+	p->frames_cap = 0;
+	p->scratch = NULL;
+	p->diagnostics = NULL;
+	p->lazy = false;
+	p->base = 0;
+	p->garbage = 0;
 	p->allocator= allocator;
 
+	p->ast = arena_alloc(allocator, sizeof(ast));
+	memset(p->ast, 0x0, sizeof(ast));
+	p->ast->source = l->source;
+	p->ast->symbols = l->symbols;
+	/* The null node, and the entries ending the member and variant lists. */
+	add_node(p, NODE_UNIT, 0, 0);
+	arrput(p->ast->members, (member){ 0 });
+	arrput(p->ast->variants, (variant){ 0 });
+	p->root = 0;
+	return p;
+}
+
+static void finish(parser *p)
+{
+	free(p->frames);
+	p->frames = NULL;
+	p->frames_len = p->frames_cap = 0;
+	arrfree(p->scratch);
+}
+
+parser *parser_init(lexer *l, arena *allocator)
+{
+	parser *p = create(l, allocator);
+	parse(p);
+	finish(p);
+	return p;
+}
+
+parser *parser_lazy(lexer *l, arena *allocator)
+{
+	parser *p = create(l, allocator);
+	p->lazy = !l->streaming;
 	parse(p);
+	finish(p);
+	return p;
+}
 
-	if (has_errors) {
-		printf("Compilation failed.\n");
-		exit(1);
+/* Index of the last top level declaration starting at or before `offset`, 0 if none. */
+static usize decl_at(ast *a, u32 offset)
+{
+	usize lo = 0, hi = arrlen(a->bases);
+	while (hi - lo > 1) {
+		usize mid = lo + (hi - lo) / 2;
+		if (a->bases[mid] <= offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
 	}
+	return lo;
+}
 
-	return p;
+/*
+ * Parse the skipped body of `fn`, top level declaration `decl`, from its
+ * `{`, the current token.
+ */
+static node_id parse_body(parser *p, node_id fn, usize decl)
+{
+	ast *a = p->ast;
+	usize errors = arrlen(p->diagnostics);
+	bool lazy = p->lazy;
+	p->lazy = false;
+	p->base = a->bases[decl];
+	node_id body = parse_compound(p);
+	p->base = 0;
+	p->lazy = lazy;
+	/* Where the parser gave up the lexer's errors are still reported, as by `parse()`. */
+	u32 end = decl + 1 < arrlen(a->bases) ? a->bases[decl + 1] : p->lexer->size;
+	while (!match_peek(p, TOKEN_END) && peek(p).offset < end) {
+		advance(p);
+	}
+	if (arrlen(p->diagnostics) > errors) {
+		body = 0;
+	}
+	/* Parsing may have grown the table. */
+	a->functions[a->data[fn]].body = body;
+	a->functions[a->data[fn]].lazy = 0;
+	return body;
+}
+
+node_id parser_body(parser *p, node_id fn)
+{
+	ast *a = p->ast;
+	usize lazy = a->functions[a->data[fn]].lazy;
+	if (!lazy) {
+		return a->functions[a->data[fn]].body;
+	}
+
+	usize cursor = p->lexer->cursor;
+	p->lexer->cursor = lazy;
+	node_id body = parse_body(p, fn, decl_at(a, peek(p).offset));
+	p->lexer->cursor = cursor;
+	finish(p);
+	return body;
+}
+
+/*
+ * Push the children of node `n` on `stack`, null ones included. The
+ * types of members and parameters and the values of variants are
+ * children of their aggregate or function.
+ */
+static void push_children(ast *a, node_id n, node_id **stack)
+{
+	u32 i = a->data[n];
+	switch (a->kinds[n]) {
+	case NODE_BINARY:
+	case NODE_RANGE:
+	case NODE_ARRAY_SUBSCRIPT:
+	case NODE_ACCESS:
+	case NODE_CAST:
+		arrpush(*stack, a->binaries[i].left);
+		arrpush(*stack, a->binaries[i].right);
+		break;
+	case NODE_UNARY:
+	case NODE_POSTFIX:
+	case NODE_PTR_TYPE:
+		arrpush(*stack, a->unaries[i].operand);
+		break;
+	case NODE_RETURN:
+	case NODE_IMPORT:
+		arrpush(*stack, i);
+		break;
+	case NODE_UNIT:
+	case NODE_STRUCT_INIT:
+		for (u32 k = 0; k < a->lists[i].len; k++) {
+			arrpush(*stack, a->children[a->lists[i].start + k]);
+		}
+		break;
+	case NODE_CALL:
+		for (u32 k = 0; k < a->calls[i].argc; k++) {
+			arrpush(*stack, a->children[a->calls[i].args + k]);
+		}
+		break;
+	case NODE_FOR: {
+		ast_for *f = &a->fors[i];
+		for (u32 k = 0; k < f->slice_len; k++) {
+			arrpush(*stack, a->children[f->slices + k]);
+		}
+		for (u32 k = 0; k < f->capture_len; k++) {
+			arrpush(*stack, a->children[f->captures + k]);
+		}
+		arrpush(*stack, f->body);
+		break;
+	}
+	case NODE_WHILE:
+	case NODE_IF:
+		arrpush(*stack, a->loops[i].condition);
+		arrpush(*stack, a->loops[i].body);
+		break;
+	case NODE_VAR_DECL:
+		arrpush(*stack, a->decls[i].type);
+		arrpush(*stack, a->decls[i].value);
+		break;
+	case NODE_FUNCTION:
+		arrpush(*stack, a->functions[i].type);
+		arrpush(*stack, a->functions[i].body);
+		for (u32 m = a->functions[i].params; m; m = a->members[m].next) {
+			arrpush(*stack, a->members[m].type);
+		}
+		break;
+	case NODE_STRUCT:
+	case NODE_UNION:
+		for (u32 m = a->aggregates[i].first; m; m = a->members[m].next) {
+			arrpush(*stack, a->members[m].type);
+		}
+		break;
+	case NODE_ENUM:
+		for (u32 v = a->aggregates[i].first; v; v = a->variants[v].next) {
+			arrpush(*stack, a->variants[v].value);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* Number of nodes in the subtree `n`. */
+static usize tree_size(ast *a, node_id n)
+{
+	node_id *stack = NULL;
+	usize size = 0;
+	arrpush(stack, n);
+	while (arrlen(stack)) {
+		n = arrpop(stack);
+		if (!n) continue;
+		size += 1;
+		push_children(a, n, &stack);
+	}
+	arrfree(stack);
+	return size;
+}
+
+/* Entry of a table that is not reachable from the root, see `compact()`. */
+#define DEAD UINT32_MAX
+
+/* New index of every entry of every table, or `DEAD`. */
+typedef struct {
+	u32 *nodes, *integers, *floats, *binaries, *unaries, *lists, *children;
+	u32 *calls, *fors, *loops, *decls, *functions, *aggregates, *members, *variants;
+} ast_maps;
+
+static u32 *dead_map(usize len)
+{
+	u32 *map = malloc((len ? len : 1) * sizeof(u32));
+	memset(map, 0xff, len * sizeof(u32));
+	return map;
+}
+
+static void mark_run(u32 *map, u32 start, u32 len)
+{
+	for (u32 k = 0; k < len; k++) map[start + k] = 0;
+}
+
+/* Mark every entry reachable from `root`. */
+static void mark(ast *a, ast_maps *m, node_id root)
+{
+	node_id *stack = NULL;
+	arrpush(stack, root);
+	while (arrlen(stack)) {
+		node_id n = arrpop(stack);
+		if (!n || m->nodes[n] != DEAD) continue;
+		m->nodes[n] = 0;
+		u32 i = a->data[n];
+		switch (a->kinds[n]) {
+		case NODE_INTEGER: m->integers[i] = 0; break;
+		case NODE_FLOAT: m->floats[i] = 0; break;
+		case NODE_BINARY:
+		case NODE_RANGE:
+		case NODE_ARRAY_SUBSCRIPT:
+		case NODE_ACCESS:
+		case NODE_CAST:
+			m->binaries[i] = 0;
+			break;
+		case NODE_UNARY:
+		case NODE_POSTFIX:
+		case NODE_PTR_TYPE:
+			m->unaries[i] = 0;
+			break;
+		case NODE_UNIT:
+		case NODE_STRUCT_INIT:
+			m->lists[i] = 0;
+			mark_run(m->children, a->lists[i].start, a->lists[i].len);
+			break;
+		case NODE_CALL:
+			m->calls[i] = 0;
+			mark_run(m->children, a->calls[i].args, a->calls[i].argc);
+			break;
+		case NODE_FOR:
+			m->fors[i] = 0;
+			mark_run(m->children, a->fors[i].slices, a->fors[i].slice_len);
+			mark_run(m->children, a->fors[i].captures, a->fors[i].capture_len);
+			break;
+		case NODE_WHILE:
+		case NODE_IF:
+			m->loops[i] = 0;
+			break;
+		case NODE_VAR_DECL: m->decls[i] = 0; break;
+		case NODE_FUNCTION:
+			m->functions[i] = 0;
+			for (u32 k = a->functions[i].params; k; k = a->members[k].next) m->members[k] = 0;
+			break;
+		case NODE_STRUCT:
+		case NODE_UNION:
+			m->aggregates[i] = 0;
+			for (u32 k = a->aggregates[i].first; k; k = a->members[k].next) m->members[k] = 0;
+			break;
+		case NODE_ENUM:
+			m->aggregates[i] = 0;
+			for (u32 k = a->aggregates[i].first; k; k = a->variants[k].next) m->variants[k] = 0;
+			break;
+		default:
+			break;
+		}
+		push_children(a, n, &stack);
+	}
+	arrfree(stack);
+}
+
+/*
+ * Move the live entries of `table` down to their new index, in order,
+ * and set its length. `map` is turned from marks into those indices.
+ */
+#define SQUEEZE(table, map) do { \
+	u32 kept = 0; \
+	for (usize k = 0; k < arrlen(a->table); k++) { \
+		if (map[k] == DEAD) continue; \
+		map[k] = kept; \
+		a->table[kept++] = a->table[k]; \
+	} \
+	arrsetlen(a->table, kept); \
+} while (0)
+
+/*
+ * Drop the nodes and the entries of the side tables that the root can't
+ * reach anymore, `parser_edit()` leaves the replaced declarations
+ * behind. The others keep their order and their references are
+ * renumbered. This costs the size of the tables, so it only runs once
+ * they are half garbage.
+ */
+static void compact(parser *p)
+{
+	ast *a = p->ast;
+	ast_maps m = {
+		dead_map(arrlen(a->kinds)), dead_map(arrlen(a->integers)), dead_map(arrlen(a->floats)),
+		dead_map(arrlen(a->binaries)), dead_map(arrlen(a->unaries)), dead_map(arrlen(a->lists)),
+		dead_map(arrlen(a->children)), dead_map(arrlen(a->calls)), dead_map(arrlen(a->fors)),
+		dead_map(arrlen(a->loops)), dead_map(arrlen(a->decls)), dead_map(arrlen(a->functions)),
+		dead_map(arrlen(a->aggregates)), dead_map(arrlen(a->members)), dead_map(arrlen(a->variants)),
+	};
+	/* The null node and the entries ending the lists stay where they are. */
+	m.nodes[0] = m.members[0] = m.variants[0] = 0;
+	mark(a, &m, p->root);
+
+	/* The nodes last, the other columns follow their map. */
+	SQUEEZE(integers, m.integers);
+	SQUEEZE(floats, m.floats);
+	SQUEEZE(binaries, m.binaries);
+	SQUEEZE(unaries, m.unaries);
+	SQUEEZE(lists, m.lists);
+	SQUEEZE(children, m.children);
+	SQUEEZE(calls, m.calls);
+	SQUEEZE(fors, m.fors);
+	SQUEEZE(loops, m.loops);
+	SQUEEZE(decls, m.decls);
+	SQUEEZE(functions, m.functions);
+	SQUEEZE(aggregates, m.aggregates);
+	SQUEEZE(members, m.members);
+	SQUEEZE(variants, m.variants);
+	u32 nodes = 0;
+	for (usize n = 0; n < arrlen(a->kinds); n++) {
+		if (m.nodes[n] == DEAD) continue;
+		m.nodes[n] = nodes;
+		a->kinds[nodes] = a->kinds[n];
+		a->offsets[nodes] = a->offsets[n];
+		a->data[nodes++] = a->data[n];
+	}
+	arrsetlen(a->kinds, nodes);
+	arrsetlen(a->offsets, nodes);
+	arrsetlen(a->data, nodes);
+
+	/* Every entry is live now, renumber what it points to. */
+	for (usize n = 1; n < nodes; n++) {
+		u32 *i = &a->data[n];
+		switch (a->kinds[n]) {
+		case NODE_INTEGER: *i = m.integers[*i]; break;
+		case NODE_FLOAT: *i = m.floats[*i]; break;
+		case NODE_BINARY:
+		case NODE_RANGE:
+		case NODE_ARRAY_SUBSCRIPT:
+		case NODE_ACCESS:
+		case NODE_CAST:
+			*i = m.binaries[*i];
+			break;
+		case NODE_UNARY:
+		case NODE_POSTFIX:
+		case NODE_PTR_TYPE:
+			*i = m.unaries[*i];
+			break;
+		case NODE_RETURN:
+		case NODE_IMPORT:
+			*i = m.nodes[*i];
+			break;
+		case NODE_UNIT:
+		case NODE_STRUCT_INIT:
+			*i = m.lists[*i];
+			break;
+		case NODE_CALL: *i = m.calls[*i]; break;
+		case NODE_FOR: *i = m.fors[*i]; break;
+		case NODE_WHILE:
+		case NODE_IF:
+			*i = m.loops[*i];
+			break;
+		case NODE_VAR_DECL: *i = m.decls[*i]; break;
+		case NODE_FUNCTION: *i = m.functions[*i]; break;
+		case NODE_STRUCT:
+		case NODE_UNION:
+			*i = m.aggregates[*i];
+			a->aggregates[*i].first = m.members[a->aggregates[*i].first];
+			break;
+		case NODE_ENUM:
+			*i = m.aggregates[*i];
+			a->aggregates[*i].first = m.variants[a->aggregates[*i].first];
+			break;
+		default:
+			break;
+		}
+	}
+	for (usize k = 0; k < arrlen(a->binaries); k++) {
+		a->binaries[k].left = m.nodes[a->binaries[k].left];
+		a->binaries[k].right = m.nodes[a->binaries[k].right];
+	}
+	for (usize k = 0; k < arrlen(a->unaries); k++) {
+		a->unaries[k].operand = m.nodes[a->unaries[k].operand];
+	}
+	/* Runs are kept whole, so they stay contiguous. Empty ones point anywhere. */
+	for (usize k = 0; k < arrlen(a->lists); k++) {
+		a->lists[k].start = a->lists[k].len ? m.children[a->lists[k].start] : 0;
+	}
+	for (usize k = 0; k < arrlen(a->children); k++) {
+		a->children[k] = m.nodes[a->children[k]];
+	}
+	for (usize k = 0; k < arrlen(a->calls); k++) {
+		a->calls[k].args = a->calls[k].argc ? m.children[a->calls[k].args] : 0;
+	}
+	for (usize k = 0; k < arrlen(a->fors); k++) {
+		ast_for *f = &a->fors[k];
+		f->slices = f->slice_len ? m.children[f->slices] : 0;
+		f->captures = f->capture_len ? m.children[f->captures] : 0;
+		f->body = m.nodes[f->body];
+	}
+	for (usize k = 0; k < arrlen(a->loops); k++) {
+		a->loops[k].condition = m.nodes[a->loops[k].condition];
+		a->loops[k].body = m.nodes[a->loops[k].body];
+	}
+	for (usize k = 0; k < arrlen(a->decls); k++) {
+		a->decls[k].type = m.nodes[a->decls[k].type];
+		a->decls[k].value = m.nodes[a->decls[k].value];
+	}
+	for (usize k = 0; k < arrlen(a->functions); k++) {
+		ast_function *f = &a->functions[k];
+		f->type = m.nodes[f->type];
+		f->body = m.nodes[f->body];
+		f->params = m.members[f->params];
+	}
+	for (usize k = 1; k < arrlen(a->members); k++) {
+		a->members[k].type = m.nodes[a->members[k].type];
+		a->members[k].next = m.members[a->members[k].next];
+	}
+	for (usize k = 1; k < arrlen(a->variants); k++) {
+		a->variants[k].value = m.nodes[a->variants[k].value];
+		a->variants[k].next = m.variants[a->variants[k].next];
+	}
+	p->root = m.nodes[p->root];
+	p->garbage = 0;
+
+	free(m.nodes); free(m.integers); free(m.floats); free(m.binaries); free(m.unaries);
+	free(m.lists); free(m.children); free(m.calls); free(m.fors); free(m.loops);
+	free(m.decls); free(m.functions); free(m.aggregates); free(m.members); free(m.variants);
+}
+#undef SQUEEZE
+
+/*
+ * Tokens the parser may look at past the end of a declaration, and
+ * bytes the lexer may read past the end of a token.
+ */
+#define LOOKAHEAD 3
+
+node_id parser_edit(parser *p, char *source, usize size, u32 start, u32 end, u32 len)
+{
+	ast *a = p->ast;
+	lexer *l = p->lexer;
+	/* Offsets past the edit move by this much, modulo 2^32. */
+	u32 delta = len - (end - start);
+
+	/*
+	 * The offsets of the `{` of the skipped bodies, the old tokens may
+	 * point in text the edit overwrote: the bodies are parsed from the
+	 * new one.
+	 */
+	ast_list root = a->lists[a->data[p->root]];
+	u32 *braces = NULL;
+	for (u32 i = 0; p->lazy && i < root.len; i++) {
+		node_id decl = a->children[root.start + i];
+		u32 lazy = a->kinds[decl] == NODE_FUNCTION ? a->functions[a->data[decl]].lazy : 0;
+		arrput(braces, lazy ? l->tokens.offsets[lazy] : 0);
+	}
+	p->lazy = false;
+	a->source = source;
+
+	/*
+	 * The declaration around the edit, or the one before when the edit
+	 * is in the tokens it may have looked at. The first is parsed from
+	 * the start of the file.
+	 */
+	usize first = decl_at(a, start);
+	lexer_restart(l, source, size, first ? a->bases[first] : 0);
+	if (first && lexer_peek(l, LOOKAHEAD).offset + LOOKAHEAD > start) {
+		first -= 1;
+	}
+	/* The text before the edit did not move. */
+	for (usize i = 0; i < first && i < arrlen(braces); i++) {
+		if (!braces[i]) continue;
+		lexer_restart(l, source, size, braces[i]);
+		parse_body(p, a->children[root.start + i], i);
+	}
+	lexer_restart(l, source, size, first ? a->bases[first] : 0);
+	if (!first) {
+		/* A call at the start of the file is at the token before, there is none. */
+		memset(&p->previous, 0x0, sizeof(token));
+	}
+
+	/*
+	 * Parse declarations until one starts where an old declaration past
+	 * the edit does, the old ones are kept from there: the text that
+	 * follows is the same and the lexer starts anew at a token.
+	 */
+	u32 *fresh = NULL;
+	usize last = first;
+	for (;;) {
+		u32 at = peek(p).offset;
+		while (last < root.len && (a->bases[last] < end || (u32)(a->bases[last] + delta) < at)) {
+			last += 1;
+		}
+		/* Only the first statement of the file may be anything, see `parse()`. */
+		bool any = !first && !arrlen(fresh);
+		if (last == root.len ? at == size : (u32)(a->bases[last] + delta) == at
+			&& (any || is_decl(a->kinds[a->children[root.start + last]]))) {
+			break;
+		}
+
+		node_id decl = parse_top(p);
+		if (decl && !is_decl(a->kinds[decl]) && !any) {
+			error(p, "expected function, struct, enum, union, global variable or import statement.");
+			decl = 0;
+		}
+		if (!decl) {
+			/* `parse()` drops whatever follows too, but the lexer's errors. */
+			while (!match_peek(p, TOKEN_END)) {
+				advance(p);
+			}
+			last = root.len;
+			break;
+		}
+		arrput(p->scratch, decl);
+		arrput(fresh, p->base);
+	}
+	p->base = 0;
+
+	for (usize i = first; i < last; i++) {
+		p->garbage += tree_size(a, a->children[root.start + i]);
+	}
+	usize added = arrlen(fresh);
+	if (added == last - first) {
+		if (added) memcpy(a->children + root.start + first, p->scratch, added * sizeof(node_id));
+	} else {
+		if (first) {
+			arrinsn(p->scratch, 0, first);
+			memcpy(p->scratch, a->children + root.start, first * sizeof(node_id));
+		}
+		for (usize i = last; i < root.len; i++) {
+			arrput(p->scratch, a->children[root.start + i]);
+		}
+		/* The old list stays behind with its node. */
+		p->garbage += root.len + 1;
+		p->root = add_list(p, NODE_UNIT, 0, 0);
+	}
+
+	if (added > last - first) {
+		arrinsn(a->bases, first, added - (last - first));
+	} else if (added < last - first) {
+		arrdeln(a->bases, first, (last - first) - added);
+	}
+	if (added) {
+		memcpy(a->bases + first, fresh, added * sizeof(*fresh));
+	}
+	u32 *bases = a->bases;
+	for (usize i = first + added, n = arrlen(bases); delta && i < n; i++) {
+		bases[i] += delta;
+	}
+	arrfree(fresh);
+
+	for (usize i = last; i < arrlen(braces); i++) {
+		if (!braces[i]) continue;
+		usize at = i - last + first + added;
+		lexer_restart(l, source, size, braces[i] + delta);
+		parse_body(p, a->children[a->lists[a->data[p->root]].start + at], at);
+	}
+	arrfree(braces);
+	finish(p);
+
+	if (p->garbage * 2 > arrlen(a->kinds)) {
+		compact(p);
+	}
+	return p->root;
+}
+
+/* Sections with fewer tokens than this are not worth a thread. */
+#define SECTION_MIN (1 << 16)
+
+/* Number of entries of every table of an AST. */
+typedef struct {
+	u32 nodes, integers, floats, binaries, unaries, lists, children;
+	u32 calls, fors, loops, decls, functions, aggregates, members, variants;
+} ast_counts;
+
+typedef struct {
+	/* Tokens [start, end) of `lexer`. */
+	lexer *lexer;
+	usize start, end;
+	arena arena;
+	parser *p;
+	/* Something the serial parser could accept or complain about. */
+	bool failed;
+	/* Where the tables of the section start in the spliced AST. */
+	ast_counts base;
+	ast *dst;
+	pthread_t thread;
+	bool spawned;
+} section;
+
+/*
+ * Index of the token that follows the top level declaration starting
+ * at token `i`, found by matching brackets. Named structs and unions
+ * and enums end with their closing brace, functions with the one of
+ * their body, anything else with a `;` outside of brackets. Returns 0
+ * when the declaration is not terminated.
+ */
+static usize decl_end(token_list *t, usize i)
+{
+	u8 *types = t->types;
+	usize depth = 0;
+	bool braced = types[i] == TOKEN_ENUM || ((types[i] == TOKEN_STRUCT || types[i] == TOKEN_UNION)
+			&& i + 1 < t->len && types[i + 1] == TOKEN_IDENTIFIER);
+
+	for (; i < t->len; i++) {
+		switch (types[i]) {
+		case TOKEN_LCURLY:
+			/* Only a function body opens a brace right after a `)`. */
+			if (depth == 0 && i > 0 && types[i - 1] == TOKEN_RPAREN) braced = true;
+			/* fallthrough */
+		case TOKEN_LPAREN:
+		case TOKEN_LSQUARE:
+			depth += 1;
+			break;
+		case TOKEN_RCURLY:
+		case TOKEN_RPAREN:
+		case TOKEN_RSQUARE:
+			if (depth == 0) return 0;
+			depth -= 1;
+			if (depth == 0 && braced && types[i] == TOKEN_RCURLY) return i + 1;
+			break;
+		case TOKEN_SEMICOLON:
+			if (depth == 0) return i + 1;
+			break;
+		case TOKEN_ERROR:
+			return 0;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Parse the declarations of a section, they are left on the scratch
+ * stack. Anything the serial parser would complain about, or accept
+ * only as the very first statement of the file, is an error here.
+ */
+static void *parse_section(void *arg)
+{
+	section *s = arg;
+	s->p = create(lexer_view(s->lexer, s->start, s->end, &s->arena), &s->arena);
+	parser *p = s->p;
+	while (!match_peek(p, TOKEN_END)) {
+		node_id decl = parse_top(p);
+		if (!decl || !is_decl(p->ast->kinds[decl]) || arrlen(p->diagnostics)) {
+			s->failed = true;
+			break;
+		}
+		add_top(p, decl);
+	}
+	lexer_view_deinit(p->lexer);
+	return NULL;
+}
+
+static void count(ast_counts *c, ast *a)
+{
+	/* Entry 0 of the nodes, members and variants is not spliced. */
+	c->nodes += arrlen(a->kinds) - 1;
+	c->integers += arrlen(a->integers);
+	c->floats += arrlen(a->floats);
+	c->binaries += arrlen(a->binaries);
+	c->unaries += arrlen(a->unaries);
+	c->lists += arrlen(a->lists);
+	c->children += arrlen(a->children);
+	c->calls += arrlen(a->calls);
+	c->fors += arrlen(a->fors);
+	c->loops += arrlen(a->loops);
+	c->decls += arrlen(a->decls);
+	c->functions += arrlen(a->functions);
+	c->aggregates += arrlen(a->aggregates);
+	c->members += arrlen(a->members) - 1;
+	c->variants += arrlen(a->variants) - 1;
+}
+
+/* Map a node of a section to the spliced AST, the null node stays null. */
+static node_id rebase(node_id n, u32 base)
+{
+	return n ? n + base : 0;
+}
+
+#define COPY(table) if (arrlen(src->table)) \
+	memcpy(dst->table + b->table, src->table, arrlen(src->table) * sizeof(*src->table))
+
+/*
+ * Copy the tables of a section at its place in the spliced AST and
+ * shift every index they contain. Sections don't overlap, so they are
+ * all spliced at the same time.
+ */
+static void *splice_section(void *arg)
+{
+	section *s = arg;
+	ast *src = s->p->ast;
+	ast *dst = s->dst;
+	ast_counts *b = &s->base;
+	usize n = arrlen(src->kinds);
+
+	memcpy(dst->kinds + b->nodes + 1, src->kinds + 1, (n - 1) * sizeof(*src->kinds));
+	memcpy(dst->offsets + b->nodes + 1, src->offsets + 1, (n - 1) * sizeof(*src->offsets));
+	for (usize i = 1; i < n; i++) {
+		u32 data = src->data[i];
+		switch (src->kinds[i]) {
+		case NODE_INTEGER: data += b->integers; break;
+		case NODE_FLOAT: data += b->floats; break;
+		case NODE_BINARY:
+		case NODE_RANGE:
+		case NODE_ARRAY_SUBSCRIPT:
+		case NODE_ACCESS:
+		case NODE_CAST:
+			data += b->binaries;
+			break;
+		case NODE_UNARY:
+		case NODE_POSTFIX:
+		case NODE_PTR_TYPE:
+			data += b->unaries;
+			break;
+		case NODE_RETURN:
+		case NODE_IMPORT:
+			data = rebase(data, b->nodes);
+			break;
+		case NODE_UNIT:
+		case NODE_STRUCT_INIT:
+			data += b->lists;
+			break;
+		case NODE_CALL: data += b->calls; break;
+		case NODE_FOR: data += b->fors; break;
+		case NODE_WHILE:
+		case NODE_IF:
+			data += b->loops;
+			break;
+		case NODE_VAR_DECL: data += b->decls; break;
+		case NODE_FUNCTION: data += b->functions; break;
+		case NODE_STRUCT:
+		case NODE_UNION:
+		case NODE_ENUM:
+			data += b->aggregates;
+			break;
+		default:
+			break;
+		}
+		dst->data[b->nodes + i] = data;
+	}
+
+	COPY(integers);
+	COPY(floats);
+	for (usize i = 0; i < arrlen(src->binaries); i++) {
+		ast_binary *x = &dst->binaries[b->binaries + i];
+		*x = src->binaries[i];
+		x->left = rebase(x->left, b->nodes);
+		x->right = rebase(x->right, b->nodes);
+	}
+	for (usize i = 0; i < arrlen(src->unaries); i++) {
+		ast_unary *x = &dst->unaries[b->unaries + i];
+		*x = src->unaries[i];
+		x->operand = rebase(x->operand, b->nodes);
+	}
+	for (usize i = 0; i < arrlen(src->lists); i++) {
+		ast_list *x = &dst->lists[b->lists + i];
+		*x = src->lists[i];
+		x->start += b->children;
+	}
+	for (usize i = 0; i < arrlen(src->children); i++) {
+		dst->children[b->children + i] = rebase(src->children[i], b->nodes);
+	}
+	for (usize i = 0; i < arrlen(src->calls); i++) {
+		ast_call *x = &dst->calls[b->calls + i];
+		*x = src->calls[i];
+		x->args += b->children;
+	}
+	for (usize i = 0; i < arrlen(src->fors); i++) {
+		ast_for *x = &dst->fors[b->fors + i];
+		*x = src->fors[i];
+		x->slices += b->children;
+		x->captures += b->children;
+		x->body = rebase(x->body, b->nodes);
+	}
+	for (usize i = 0; i < arrlen(src->loops); i++) {
+		ast_loop *x = &dst->loops[b->loops + i];
+		*x = src->loops[i];
+		x->condition = rebase(x->condition, b->nodes);
+		x->body = rebase(x->body, b->nodes);
+	}
+	for (usize i = 0; i < arrlen(src->decls); i++) {
+		ast_decl *x = &dst->decls[b->decls + i];
+		*x = src->decls[i];
+		x->type = rebase(x->type, b->nodes);
+		x->value = rebase(x->value, b->nodes);
+	}
+	for (usize i = 0; i < arrlen(src->functions); i++) {
+		ast_function *x = &dst->functions[b->functions + i];
+		*x = src->functions[i];
+		x->type = rebase(x->type, b->nodes);
+		x->body = rebase(x->body, b->nodes);
+		x->params = rebase(x->params, b->members);
+	}
+	for (usize i = 0; i < arrlen(src->aggregates); i++) {
+		ast_aggregate *x = &dst->aggregates[b->aggregates + i];
+		*x = src->aggregates[i];
+	}
+	for (usize i = 1; i < n; i++) {
+		if (src->kinds[i] != NODE_STRUCT && src->kinds[i] != NODE_UNION && src->kinds[i] != NODE_ENUM) continue;
+		ast_aggregate *x = &dst->aggregates[b->aggregates + src->data[i]];
+		x->first = rebase(x->first, src->kinds[i] == NODE_ENUM ? b->variants : b->members);
+	}
+	for (usize i = 1; i < arrlen(src->members); i++) {
+		member *x = &dst->members[b->members + i];
+		*x = src->members[i];
+		x->type = rebase(x->type, b->nodes);
+		x->next = rebase(x->next, b->members);
+	}
+	for (usize i = 1; i < arrlen(src->variants); i++) {
+		variant *x = &dst->variants[b->variants + i];
+		*x = src->variants[i];
+		x->value = rebase(x->value, b->nodes);
+		x->next = rebase(x->next, b->variants);
+	}
+	return NULL;
+}
+
+#undef COPY
+
+/* Run `job` on every section, the first one on the calling thread. */
+static void run_sections(void *(*job)(void *), section *sections, usize n)
+{
+	for (usize i = 1; i < n; i++) {
+		sections[i].spawned = pthread_create(&sections[i].thread, NULL, job, &sections[i]) == 0;
+		if (!sections[i].spawned) job(&sections[i]);
+	}
+	job(&sections[0]);
+	for (usize i = 1; i < n; i++) {
+		if (sections[i].spawned) pthread_join(sections[i].thread, NULL);
+	}
+}
+
+static void free_sections(section *sections, usize n)
+{
+	for (usize i = 0; i < n; i++) {
+		parser *p = sections[i].p;
+		free(p->frames);
+		arrfree(p->scratch);
+		parser_deinit(p);
+		arena_deinit(sections[i].arena);
+	}
+	free(sections);
+}
+
+parser *parser_parallel(lexer *l, arena *allocator, usize threads)
+{
+	token_list *t = &l->tokens;
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if (threads > t->len / SECTION_MIN) {
+		threads = t->len / SECTION_MIN;
+	}
+	if (l->streaming || l->cursor != 0 || threads < 2) {
+		return parser_init(l, allocator);
+	}
+
+	/* Cut the token list in parts of about the same size. */
+	section *sections = malloc(threads * sizeof(section));
+	usize n = 0;
+	usize i = 0;
+	while (i < t->len) {
+		usize start = i;
+		usize target = start + (t->len - start) / (threads - n);
+		while (i < target) {
+			i = decl_end(t, i);
+			if (!i) {
+				free(sections);
+				return parser_init(l, allocator);
+			}
+		}
+		section *s = &sections[n++];
+		s->lexer = l;
+		s->start = start;
+		s->end = i;
+		s->failed = false;
+		s->arena = arena_init(0x10000);
+	}
+
+	run_sections(parse_section, sections, n);
+	for (usize k = 0; k < n; k++) {
+		if (sections[k].failed) {
+			free_sections(sections, n);
+			return parser_init(l, allocator);
+		}
+	}
+
+	parser *p = create(l, allocator);
+	ast *a = p->ast;
+	ast_counts total = { .nodes = 1, .members = 1, .variants = 1 };
+	for (usize k = 0; k < n; k++) {
+		sections[k].base = total;
+		/* Section indices start at 1 where entry 0 is reserved. */
+		sections[k].base.nodes -= 1;
+		sections[k].base.members -= 1;
+		sections[k].base.variants -= 1;
+		sections[k].dst = a;
+		count(&total, sections[k].p->ast);
+	}
+	arrsetlen(a->kinds, total.nodes);
+	arrsetlen(a->offsets, total.nodes);
+	arrsetlen(a->data, total.nodes);
+	arrsetlen(a->integers, total.integers);
+	arrsetlen(a->floats, total.floats);
+	arrsetlen(a->binaries, total.binaries);
+	arrsetlen(a->unaries, total.unaries);
+	arrsetlen(a->lists, total.lists);
+	arrsetlen(a->children, total.children);
+	arrsetlen(a->calls, total.calls);
+	arrsetlen(a->fors, total.fors);
+	arrsetlen(a->loops, total.loops);
+	arrsetlen(a->decls, total.decls);
+	arrsetlen(a->functions, total.functions);
+	arrsetlen(a->aggregates, total.aggregates);
+	arrsetlen(a->members, total.members);
+	arrsetlen(a->variants, total.variants);
+	run_sections(splice_section, sections, n);
+
+	for (usize k = 0; k < n; k++) {
+		parser *sp = sections[k].p;
+		for (usize d = 0; d < arrlen(sp->scratch); d++) {
+			arrput(p->scratch, rebase(sp->scratch[d], sections[k].base.nodes));
+			/* The views share the offsets of `l`. */
+			arrput(a->bases, sp->ast->bases[d]);
+		}
+	}
+	free_sections(sections, n);
+
+	p->root = add_list(p, NODE_UNIT, 0, 0);
+	l->cursor = t->len;
+	finish(p);
+	return p;
+}
+
+/* Bump when the layout of the cache file or of any table changes. */
+#define CACHE_VERSION 2
+
+/* Every table of `ast`, in the order of the cache file. */
+#define COLUMN(name) { offsetof(ast, name), sizeof(*((ast *)0)->name) }
+static const struct {
+	usize field;
+	u32 size;
+} columns[] = {
+	COLUMN(kinds), COLUMN(offsets), COLUMN(data), COLUMN(integers), COLUMN(floats),
+	COLUMN(binaries), COLUMN(unaries), COLUMN(lists), COLUMN(children), COLUMN(calls),
+	COLUMN(fors), COLUMN(loops), COLUMN(decls), COLUMN(functions), COLUMN(aggregates),
+	COLUMN(members), COLUMN(variants), COLUMN(bases),
+};
+#undef COLUMN
+
+#define COLUMNS (sizeof(columns) / sizeof(*columns))
+
+typedef struct {
+	/* From the start of the file, 0 for an empty table. */
+	u64 offset;
+	u32 len;
+	u32 size;
+} cache_column;
+
+typedef struct {
+	char magic[8];
+	u32 version;
+	/* 1 in the byte order of the writer. */
+	u32 byte_order;
+	u64 source_size;
+	u64 source_hash;
+	node_id root;
+	/* Symbols, the reserved 0 included. */
+	u32 symbols;
+	/* The length of every symbol, then their names one after the other. */
+	u64 names;
+	cache_column columns[COLUMNS];
+} cache_header;
+
+static const char cache_magic[8] = "lcast";
+
+/*
+ * Every table is preceded by a stb_ds header, so that the arrays of
+ * a mapped AST work in place with `arrlen()` and friends.
+ */
+#define TABLE_ALIGN 16
+#define TABLE_HEADER sizeof(stbds_array_header)
+
+/* FNV-1a, to tell whether the source changed since the cache was made. */
+static u64 source_hash(char *s, usize len)
+{
+	u64 h = 14695981039346656037ull;
+	for (usize i = 0; i < len; i++) {
+		h = (h ^ (u8)s[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+static void **column(ast *a, usize i)
+{
+	return (void **)((char *)a + columns[i].field);
+}
+
+static usize align_up(usize n, usize align)
+{
+	return (n + align - 1) & ~(align - 1);
+}
+
+static bool pad(FILE *f, usize to)
+{
+	static const char zeros[TABLE_ALIGN + TABLE_HEADER];
+	long at = ftell(f);
+	return at >= 0 && (usize)at <= to && fwrite(zeros, 1, to - at, f) == to - at;
+}
+
+bool ast_save(parser *p, char *path)
+{
+	ast *a = p->ast;
+	ast_list root = a->lists[a->data[p->root]];
+	for (u32 i = 0; i < root.len; i++) {
+		node_id decl = a->children[root.start + i];
+		if (a->kinds[decl] == NODE_FUNCTION) parser_body(p, decl);
+	}
+	if (arrlen(p->diagnostics)) {
+		return false;
+	}
+
+	interner *in = a->symbols;
+	cache_header h = { 0 };
+	memcpy(h.magic, cache_magic, sizeof(h.magic));
+	h.version = CACHE_VERSION;
+	h.byte_order = 1;
+	h.source_size = p->lexer->size;
+	h.source_hash = source_hash(p->lexer->source, p->lexer->size);
+	h.root = p->root;
+	h.symbols = in->count;
+	h.names = sizeof(h);
+
+	usize end = h.names + in->count * sizeof(u32);
+	for (u32 i = 0; i < in->count; i++) {
+		end += in->lengths[i];
+	}
+	for (usize i = 0; i < COLUMNS; i++) {
+		usize len = arrlen(*column(a, i));
+		h.columns[i].len = len;
+		h.columns[i].size = columns[i].size;
+		if (len) {
+			h.columns[i].offset = align_up(end + TABLE_HEADER, TABLE_ALIGN);
+			end = h.columns[i].offset + len * columns[i].size;
+		}
+	}
+
+	/* Write a new file and move it over the old one, which may be mapped. */
+	usize n = strlen(path);
+	char *tmp = malloc(n + 5);
+	memcpy(tmp, path, n);
+	memcpy(tmp + n, ".tmp", 5);
+	FILE *f = fopen(tmp, "wb");
+	if (!f) {
+		free(tmp);
+		return false;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(in->lengths, sizeof(u32), in->count, f) == in->count;
+	for (u32 i = 0; ok && i < in->count; i++) {
+		ok = fwrite(in->names[i], 1, in->lengths[i], f) == in->lengths[i];
+	}
+	for (usize i = 0; ok && i < COLUMNS; i++) {
+		cache_column *c = &h.columns[i];
+		if (!c->len) continue;
+		stbds_array_header table = { c->len, c->len, NULL, 0 };
+		ok = pad(f, c->offset - TABLE_HEADER)
+			&& fwrite(&table, sizeof(table), 1, f) == 1
+			&& fwrite(*column(a, i), c->size, c->len, f) == c->len;
+	}
+	ok = fclose(f) == 0 && ok && rename(tmp, path) == 0;
+	if (!ok) {
+		unlink(tmp);
+	}
+	free(tmp);
+	return ok;
+}
+
+/* Check that the header of a cache file of `size` bytes can be trusted. */
+static bool cache_valid(cache_header *h, usize size, lexer *l)
+{
+	if (size < sizeof(*h) || memcmp(h->magic, cache_magic, sizeof(h->magic)) != 0
+			|| h->version != CACHE_VERSION || h->byte_order != 1
+			|| h->source_size != l->size || h->symbols == 0
+			|| h->names + (u64)h->symbols * sizeof(u32) > size) {
+		return false;
+	}
+	for (usize i = 0; i < COLUMNS; i++) {
+		cache_column *c = &h->columns[i];
+		if (c->size != columns[i].size) return false;
+		if (c->len && (c->offset < TABLE_HEADER || c->offset % TABLE_ALIGN
+				|| c->offset + (u64)c->len * c->size > size)) {
+			return false;
+		}
+	}
+	/* The first node is the null one, the root is a unit. */
+	if (h->columns[0].len == 0 || h->root >= h->columns[0].len) {
+		return false;
+	}
+	return source_hash(l->source, l->size) == h->source_hash;
+}
+
+/* Whether the run [start, start + len) is inside a table of `size` entries. */
+static bool in_table(u32 start, u32 len, usize size)
+{
+	return (u64)start + len <= size;
+}
+
+/*
+ * Check in one pass that every node of a mapped AST has a known kind
+ * and every index in it and in the side tables is in bounds, so that
+ * a damaged cache can't make the parser or sema read out of them. The
+ * member and variant lists must go forward, as the parser builds them,
+ * so walking them ends.
+ */
+static bool tables_valid(ast *a, node_id root, u32 symbols)
+{
+	usize nodes = arrlen(a->kinds);
+	if (arrlen(a->offsets) != nodes || arrlen(a->data) != nodes
+			|| arrlen(a->members) == 0 || arrlen(a->variants) == 0
+			|| a->kinds[root] != NODE_UNIT) {
+		return false;
+	}
+	for (usize n = 1; n < nodes; n++) {
+		u32 i = a->data[n];
+		bool ok;
+		switch (a->kinds[n]) {
+		case NODE_IDENTIFIER:
+		case NODE_LABEL:
+		case NODE_GOTO:
+			ok = i < symbols;
+			break;
+		case NODE_CHAR:
+		case NODE_STRING:
+		case NODE_BOOL:
+		case NODE_BREAK:
+			ok = true;
+			break;
+		case NODE_INTEGER:
+			ok = i < arrlen(a->integers);
+			break;
+		case NODE_FLOAT:
+			ok = i < arrlen(a->floats);
+			break;
+		case NODE_BINARY:
+		case NODE_RANGE:
+		case NODE_ARRAY_SUBSCRIPT:
+		case NODE_ACCESS:
+		case NODE_CAST:
+			ok = i < arrlen(a->binaries);
+			break;
+		case NODE_UNARY:
+		case NODE_POSTFIX:
+			ok = i < arrlen(a->unaries) && a->unaries[i].op <= UOP_NOT;
+			break;
+		case NODE_PTR_TYPE:
+			ok = i < arrlen(a->unaries);
+			break;
+		case NODE_RETURN:
+		case NODE_IMPORT:
+			ok = i < nodes;
+			break;
+		case NODE_UNIT:
+		case NODE_STRUCT_INIT:
+			ok = i < arrlen(a->lists);
+			break;
+		case NODE_CALL:
+			ok = i < arrlen(a->calls);
+			break;
+		case NODE_FOR:
+			ok = i < arrlen(a->fors);
+			break;
+		case NODE_WHILE:
+		case NODE_IF:
+			ok = i < arrlen(a->loops);
+			break;
+		case NODE_VAR_DECL:
+			ok = i < arrlen(a->decls);
+			break;
+		case NODE_FUNCTION:
+			ok = i < arrlen(a->functions);
+			break;
+		case NODE_STRUCT:
+		case NODE_UNION:
+			ok = i < arrlen(a->aggregates) && a->aggregates[i].first < arrlen(a->members);
+			break;
+		case NODE_ENUM:
+			ok = i < arrlen(a->aggregates) && a->aggregates[i].first < arrlen(a->variants);
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok) return false;
+	}
+
+	for (usize i = 0; i < arrlen(a->binaries); i++) {
+		ast_binary *b = &a->binaries[i];
+		if (b->left >= nodes || b->right >= nodes || b->op > OP_LE) return false;
+	}
+	for (usize i = 0; i < arrlen(a->unaries); i++) {
+		if (a->unaries[i].operand >= nodes) return false;
+	}
+	for (usize i = 0; i < arrlen(a->lists); i++) {
+		if (!in_table(a->lists[i].start, a->lists[i].len, arrlen(a->children))) return false;
+	}
+	for (usize i = 0; i < arrlen(a->children); i++) {
+		if (a->children[i] >= nodes) return false;
+	}
+	for (usize i = 0; i < arrlen(a->calls); i++) {
+		ast_call *c = &a->calls[i];
+		if (c->symbol >= symbols || !in_table(c->args, c->argc, arrlen(a->children))) return false;
+	}
+	for (usize i = 0; i < arrlen(a->fors); i++) {
+		ast_for *f = &a->fors[i];
+		if (!in_table(f->slices, f->slice_len, arrlen(a->children))
+				|| !in_table(f->captures, f->capture_len, arrlen(a->children))
+				|| f->body >= nodes) {
+			return false;
+		}
+	}
+	for (usize i = 0; i < arrlen(a->loops); i++) {
+		if (a->loops[i].condition >= nodes || a->loops[i].body >= nodes) return false;
+	}
+	for (usize i = 0; i < arrlen(a->decls); i++) {
+		ast_decl *d = &a->decls[i];
+		if (d->symbol >= symbols || d->type >= nodes || d->value >= nodes) return false;
+	}
+	for (usize i = 0; i < arrlen(a->functions); i++) {
+		ast_function *f = &a->functions[i];
+		/* `ast_save()` parsed every body. */
+		if (f->symbol >= symbols || f->type >= nodes || f->body >= nodes
+				|| f->params >= arrlen(a->members) || f->lazy) {
+			return false;
+		}
+	}
+	for (usize i = 0; i < arrlen(a->aggregates); i++) {
+		if (a->aggregates[i].symbol >= symbols) return false;
+	}
+	for (usize i = 1; i < arrlen(a->members); i++) {
+		member *m = &a->members[i];
+		if (m->type >= nodes || m->symbol >= symbols || m->next >= arrlen(a->members)
+				|| (m->next && m->next <= i)) {
+			return false;
+		}
+	}
+	for (usize i = 1; i < arrlen(a->variants); i++) {
+		variant *v = &a->variants[i];
+		if (v->value >= nodes || v->symbol >= symbols || v->next >= arrlen(a->variants)
+				|| (v->next && v->next <= i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Check that the declarations of the root are trees, so that walking
+ * them ends, and that their entry in `bases` puts their nodes and the
+ * text of their strings inside the source. Needs the indices checked.
+ */
+static bool trees_valid(ast *a, node_id root, usize source_size)
+{
+	ast_list list = a->lists[a->data[root]];
+	if (arrlen(a->bases) != list.len) {
+		return false;
+	}
+	u8 *seen = calloc(arrlen(a->kinds), 1);
+	node_id *stack = NULL;
+	bool ok = true;
+	seen[root] = 1;
+	for (u32 d = 0; ok && d < list.len; d++) {
+		u64 base = a->bases[d];
+		ok = base <= source_size && (d == 0 || a->bases[d - 1] < base);
+		arrsetlen(stack, 0);
+		arrpush(stack, a->children[list.start + d]);
+		while (ok && arrlen(stack)) {
+			node_id n = arrpop(stack);
+			if (!n) continue;
+			u64 text = a->kinds[n] == NODE_STRING ? a->data[n] : 0;
+			ok = !seen[n] && base + a->offsets[n] + text <= source_size;
+			seen[n] = 1;
+			if (ok) push_children(a, n, &stack);
+		}
+	}
+	arrfree(stack);
+	free(seen);
+	return ok;
+}
+
+parser *ast_load(lexer *l, char *path, arena *allocator)
+{
+	if (l->tokens.len != 0 || l->symbols->count != 1) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (usize)st.st_size < sizeof(cache_header)) {
+		close(fd);
+		return NULL;
+	}
+	/* Private and writable: sema writes the layout of structs in `members`. */
+	usize size = st.st_size;
+	char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	cache_header *h = (cache_header *)map;
+	u32 *lengths = (u32 *)(map + h->names);
+	u64 names = h->names + (u64)h->symbols * sizeof(u32);
+	/* The reserved symbol 0 has no name. */
+	bool ok = cache_valid(h, size, l) && lengths[0] == 0;
+	for (u32 i = 1; ok && i < h->symbols; i++) {
+		names += lengths[i];
+		ok = names <= size;
+	}
+
+	char *name = map + h->names + (u64)h->symbols * sizeof(u32);
+	for (u32 i = 1; ok && i < h->symbols; i++) {
+		ok = intern(l->symbols, name, lengths[i]) == i;
+		name += lengths[i];
+	}
+	if (!ok) {
+		munmap(map, size);
+		return NULL;
+	}
+
+	parser *p = arena_alloc(allocator, sizeof(parser));
+	memset(p, 0x0, sizeof(parser));
+	p->lexer = l;
+	p->allocator = allocator;
+	p->root = h->root;
+	p->ast = arena_alloc(allocator, sizeof(ast));
+	memset(p->ast, 0x0, sizeof(ast));
+	for (usize i = 0; i < COLUMNS; i++) {
+		cache_column *c = &h->columns[i];
+		if (!c->len) continue;
+		/* `arrlen()` reads the header of the file, take the length of the checked one. */
+		stbds_array_header table = { c->len, c->len, NULL, 0 };
+		memcpy(map + c->offset - TABLE_HEADER, &table, sizeof(table));
+		*column(p->ast, i) = map + c->offset;
+	}
+	p->ast->source = l->source;
+	p->ast->symbols = l->symbols;
+	p->ast->mapping = map;
+	p->ast->mapping_size = size;
+	if (!tables_valid(p->ast, p->root, h->symbols) || !trees_valid(p->ast, p->root, l->size)) {
+		munmap(map, size);
+		return NULL;
+	}
+	return p;
+}
+
+usize ast_size(ast *a)
+{
+	return arrlen(a->kinds) * (sizeof(*a->kinds) + sizeof(*a->offsets) + sizeof(*a->data))
+		+ arrlen(a->integers) * sizeof(*a->integers)
+		+ arrlen(a->floats) * sizeof(*a->floats)
+		+ arrlen(a->binaries) * sizeof(*a->binaries)
+		+ arrlen(a->unaries) * sizeof(*a->unaries)
+		+ arrlen(a->lists) * sizeof(*a->lists)
+		+ arrlen(a->children) * sizeof(*a->children)
+		+ arrlen(a->calls) * sizeof(*a->calls)
+		+ arrlen(a->fors) * sizeof(*a->fors)
+		+ arrlen(a->loops) * sizeof(*a->loops)
+		+ arrlen(a->decls) * sizeof(*a->decls)
+		+ arrlen(a->functions) * sizeof(*a->functions)
+		+ arrlen(a->aggregates) * sizeof(*a->aggregates)
+		+ arrlen(a->members) * sizeof(*a->members)
+		+ arrlen(a->variants) * sizeof(*a->variants)
+		+ arrlen(a->bases) * sizeof(*a->bases);
+}
+
+static bool same_symbol(ast *a, u32 x, ast *b, u32 y)
+{
+	if (!x || !y) return x == y;
+	usize len = symbol_len(a->symbols, x);
+	return len == symbol_len(b->symbols, y)
+		&& memcmp(symbol_name(a->symbols, x), symbol_name(b->symbols, y), len) == 0;
+}
+
+bool ast_equal(ast *a, node_id x, ast *b, node_id y)
+{
+	node_id *stack = NULL;
+	bool equal = true;
+	arrpush(stack, x);
+	arrpush(stack, y);
+	while (equal && arrlen(stack)) {
+		y = arrpop(stack);
+		x = arrpop(stack);
+		if (!x || !y) {
+			equal = x == y;
+			continue;
+		}
+		if (a->kinds[x] != b->kinds[y] || a->offsets[x] != b->offsets[y]) {
+			equal = false;
+			continue;
+		}
+		u32 i = a->data[x], j = b->data[y];
+#define PAIR(l, r) do { arrpush(stack, (l)); arrpush(stack, (r)); } while (0)
+		switch (a->kinds[x]) {
+		case NODE_IDENTIFIER:
+		case NODE_LABEL:
+		case NODE_GOTO:
+			equal = same_symbol(a, i, b, j);
+			break;
+		case NODE_INTEGER:
+			equal = a->integers[i] == b->integers[j];
+			break;
+		case NODE_FLOAT:
+			equal = memcmp(&a->floats[i], &b->floats[j], sizeof(f64)) == 0;
+			break;
+		case NODE_BINARY:
+		case NODE_RANGE:
+		case NODE_ARRAY_SUBSCRIPT:
+		case NODE_ACCESS:
+		case NODE_CAST:
+			equal = a->binaries[i].op == b->binaries[j].op;
+			PAIR(a->binaries[i].left, b->binaries[j].left);
+			PAIR(a->binaries[i].right, b->binaries[j].right);
+			break;
+		case NODE_UNARY:
+		case NODE_POSTFIX:
+		case NODE_PTR_TYPE:
+			equal = a->unaries[i].op == b->unaries[j].op;
+			PAIR(a->unaries[i].operand, b->unaries[j].operand);
+			break;
+		case NODE_RETURN:
+		case NODE_IMPORT:
+			PAIR(i, j);
+			break;
+		case NODE_UNIT:
+		case NODE_STRUCT_INIT:
+			equal = a->lists[i].len == b->lists[j].len;
+			for (u32 k = 0; equal && k < a->lists[i].len; k++) {
+				PAIR(a->children[a->lists[i].start + k], b->children[b->lists[j].start + k]);
+			}
+			break;
+		case NODE_CALL:
+			equal = a->calls[i].argc == b->calls[j].argc
+				&& same_symbol(a, a->calls[i].symbol, b, b->calls[j].symbol);
+			for (u32 k = 0; equal && k < a->calls[i].argc; k++) {
+				PAIR(a->children[a->calls[i].args + k], b->children[b->calls[j].args + k]);
+			}
+			break;
+		case NODE_FOR: {
+			ast_for *f = &a->fors[i], *g = &b->fors[j];
+			equal = f->slice_len == g->slice_len && f->capture_len == g->capture_len;
+			for (u32 k = 0; equal && k < f->slice_len; k++) {
+				PAIR(a->children[f->slices + k], b->children[g->slices + k]);
+			}
+			for (u32 k = 0; equal && k < f->capture_len; k++) {
+				PAIR(a->children[f->captures + k], b->children[g->captures + k]);
+			}
+			PAIR(f->body, g->body);
+			break;
+		}
+		case NODE_WHILE:
+		case NODE_IF:
+			equal = a->loops[i].flags == b->loops[j].flags;
+			PAIR(a->loops[i].condition, b->loops[j].condition);
+			PAIR(a->loops[i].body, b->loops[j].body);
+			break;
+		case NODE_VAR_DECL:
+			equal = same_symbol(a, a->decls[i].symbol, b, b->decls[j].symbol);
+			PAIR(a->decls[i].type, b->decls[j].type);
+			PAIR(a->decls[i].value, b->decls[j].value);
+			break;
+		case NODE_FUNCTION: {
+			ast_function *f = &a->functions[i], *g = &b->functions[j];
+			equal = f->param_len == g->param_len && !f->lazy == !g->lazy
+				&& same_symbol(a, f->symbol, b, g->symbol);
+			PAIR(f->type, g->type);
+			PAIR(f->body, g->body);
+			u32 m = f->params, n = g->params;
+			for (; equal && (m || n); m = a->members[m].next, n = b->members[n].next) {
+				equal = m && n && same_symbol(a, a->members[m].symbol, b, b->members[n].symbol);
+				if (equal) PAIR(a->members[m].type, b->members[n].type);
+			}
+			break;
+		}
+		case NODE_STRUCT:
+		case NODE_UNION: {
+			equal = same_symbol(a, a->aggregates[i].symbol, b, b->aggregates[j].symbol);
+			u32 m = a->aggregates[i].first, n = b->aggregates[j].first;
+			for (; equal && (m || n); m = a->members[m].next, n = b->members[n].next) {
+				equal = m && n && same_symbol(a, a->members[m].symbol, b, b->members[n].symbol);
+				if (equal) PAIR(a->members[m].type, b->members[n].type);
+			}
+			break;
+		}
+		case NODE_ENUM: {
+			equal = same_symbol(a, a->aggregates[i].symbol, b, b->aggregates[j].symbol);
+			u32 m = a->aggregates[i].first, n = b->aggregates[j].first;
+			for (; equal && (m || n); m = a->variants[m].next, n = b->variants[n].next) {
+				equal = m && n && same_symbol(a, a->variants[m].symbol, b, b->variants[n].symbol);
+				if (equal) PAIR(a->variants[m].value, b->variants[n].value);
+			}
+			break;
+		}
+		case NODE_BREAK:
+			break;
+		default:
+			equal = i == j;
+			break;
+		}
+#undef PAIR
+	}
+	arrfree(stack);
+	return equal;
+}
+
+void parser_deinit(parser *p)
+{
+	arrfree(p->diagnostics);
+	ast_deinit(p->ast);
+}
+
+void ast_deinit(ast *a)
+{
+	if (a->mapping) {
+		munmap(a->mapping, a->mapping_size);
+		a->mapping = NULL;
+		return;
+	}
+	arrfree(a->kinds);
+	arrfree(a->offsets);
+	arrfree(a->data);
+	arrfree(a->integers);
+	arrfree(a->floats);
+	arrfree(a->binaries);
+	arrfree(a->unaries);
+	arrfree(a->lists);
+	arrfree(a->children);
+	arrfree(a->calls);
+	arrfree(a->fors);
+	arrfree(a->loops);
+	arrfree(a->decls);
+	arrfree(a->functions);
+	arrfree(a->aggregates);
+	arrfree(a->members);
+	arrfree(a->variants);
+	arrfree(a->bases);
 }
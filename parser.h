@@ -4,9 +4,11 @@
 #include "lexer.h"
 #include "utils.h"
 #include <stdbool.h>
-
-struct _type;
-struct _ast_node;
+/* stb_ds takes the address of rvalue hash map keys with `typeof`, which is a GNU extension in C99. */
+#if defined(__GNUC__) && !defined(typeof)
+#define typeof __typeof__
+#endif
+#include "stb_ds.h"
 
 typedef enum {
 	OP_PLUS, // +
@@ -17,6 +19,8 @@ typedef enum {
 	OP_BOR, // |
 	OP_BAND, // &
 	OP_BXOR, // ^
+	OP_LSHIFT, // <<
+	OP_RSHIFT, // >>
 
 	OP_ASSIGN, // =
 	OP_RSHIFT_EQ, // >>=
@@ -55,27 +59,6 @@ typedef enum {
 	LAYOUT_EXTERN
 } struct_layout;
 
-typedef struct _member {
-	struct _ast_node *type;
-	char *name;
-	usize name_len;
-	struct _member *next;
-	usize offset;
-} member;
-
-typedef struct {
-	char *name;
-	usize name_len;
-	member *params;
-} function;
-
-typedef struct _variant {
-	struct _ast_node *value;
-	char *name;
-	usize name_len;
-	struct _variant *next;
-} variant;
-
 typedef enum {
 	NODE_IDENTIFIER,
 	NODE_INTEGER,
@@ -122,126 +105,293 @@ typedef enum {
 #define LOOP_UNTIL 0x2
 #define LOOP_AFTER 0x4
 
-typedef struct _ast_node {
-	node_type type;
-	source_pos position;
-	struct _type *expr_type;
-	union {
-		struct {
-			struct _ast_node *type;
-			u8 flags;
-		} ptr_type;
-		struct {
-			char *name;
-			usize name_len;
-		} label; // both label and goto
-		struct {
-			struct _ast_node *left;
-			struct _ast_node *right;
-			binary_op operator;
-		} binary;
-		struct {
-			struct _ast_node *right;
-			unary_op operator;
-		} unary;
-		u8 boolean;
-		i64 integer;
-		f64 flt; // float
-		struct {
-			char *start;
-			usize len;
-		} string;
-		char ch; // char;
-		struct {
-			struct _ast_node *condition;
-			struct _ast_node *then;
-			struct _ast_node *otherwise;
-		} ternary;
-		struct {
-			struct _ast_node *value;
-			struct _ast_node *type;
-		} cast;
-		struct {
-			struct _ast_node *expr;
-			struct _ast_node *index;
-		} subscript;
-		struct {
-			struct _ast_node *expr;
-			struct _ast_node *member;
-		} access;
-		struct {
-			struct _ast_node *expr;
-			struct _ast_node *next;
-		} unit_node;
-		struct {
-			/* This should be a list of unit_node */
-			struct _ast_node *parameters;
-			usize param_len;
-			char *name;
-			usize name_len;
-		} call;
-		struct {
-			struct _ast_node *value;
-		} ret;
-		struct {
-			/* This should be an access. */
-			struct _ast_node *path;
-		} import;
-		struct {
-			/* These should be lists of unit_node */
-			struct _ast_node *slices;
-			usize slice_len;
-			struct _ast_node *captures;
-			usize capture_len;
-			struct _ast_node* body;
-		} fr; // for
-		struct {
-			struct _ast_node *condition;
-			struct _ast_node *body;
-			u8 flags;
-		} whle; // while
-		struct {
-			struct _ast_node **statements;
-			usize stmt_len;
-		} compound;
-		struct {
-			struct _ast_node *value;
-			char *name;
-			usize name_len;
-			struct _ast_node *type;
-		} var_decl;
-		struct {
-			member *members;
-			char *name;
-			usize name_len;
-		} structure;
-		struct {
-			member *parameters;
-			usize parameters_len;
-			char *name;
-			usize name_len;
-			struct _ast_node *type;
-			struct _ast_node *body;
-		} function;
-		struct {
-			variant *variants;
-			char *name;
-			usize name_len;
-		} enm; // enum
-		struct {
-			struct _ast_node *members;
-			usize members_len;
-		} struct_init;
-	} expr;
-} ast_node;
+/* Index of a node in the `ast`, 0 is the null node. */
+typedef u32 node_id;
+
+/*
+ * Side tables of the AST. Which one a node points to, if any, depends
+ * on its kind, see `ast`.
+ */
+typedef struct {
+	node_id left;
+	node_id right;
+	binary_op op;
+} ast_binary;
+
+typedef struct {
+	node_id operand;
+	/* `unary_op`, or the `PTR_*` flags of pointer types. */
+	u32 op;
+} ast_unary;
+
+/* `len` consecutive nodes of `children`, starting at `start`. */
+typedef struct {
+	u32 start;
+	u32 len;
+} ast_list;
+
+typedef struct {
+	u32 symbol;
+	/* First argument in `children`. */
+	u32 args;
+	u32 argc;
+} ast_call;
+
+typedef struct {
+	/* First slice and first capture in `children`. */
+	u32 slices;
+	u32 captures;
+	node_id body;
+	u32 slice_len;
+	u32 capture_len;
+} ast_for;
+
+typedef struct {
+	node_id condition;
+	node_id body;
+	u8 flags;
+} ast_loop;
+
+typedef struct {
+	u32 symbol;
+	node_id type;
+	node_id value;
+} ast_decl;
+
+typedef struct {
+	u32 symbol;
+	node_id type;
+	node_id body;
+	/* First parameter in `members`. */
+	u32 params;
+	u32 param_len;
+	/*
+	 * Index of the `{` token of a body that is not parsed yet, see
+	 * `parser_body()`. 0 once it is.
+	 */
+	u32 lazy;
+} ast_function;
+
+typedef struct {
+	u32 symbol;
+	/* First entry in `members` or `variants`, 0 if none. */
+	u32 first;
+} ast_aggregate;
+
+/* Struct and union members, and function parameters. */
+typedef struct {
+	node_id type;
+	u32 symbol;
+	/* Next member of the same aggregate, 0 for the last one. */
+	u32 next;
+	/* Set by sema once the layout is known. */
+	u32 offset;
+} member;
+
+typedef struct {
+	node_id value;
+	u32 symbol;
+	u32 next;
+} variant;
+
+/*
+ * The AST is a set of columns indexed by `node_id`: the kind and the
+ * source offset of every node, and a 32 bit `data` word whose meaning
+ * depends on the kind:
+ *
+ *   NODE_IDENTIFIER, NODE_LABEL, NODE_GOTO  symbol
+ *   NODE_STRING                             length, the text is at the offset
+ *   NODE_CHAR, NODE_BOOL                    the value
+ *   NODE_INTEGER                            index in `integers`
+ *   NODE_FLOAT                              index in `floats`
+ *   NODE_BINARY, NODE_RANGE                 index in `binaries`
+ *   NODE_ARRAY_SUBSCRIPT                    `binaries`, left[right]
+ *   NODE_ACCESS                             `binaries`, left.right
+ *   NODE_CAST                               `binaries`, (right) left
+ *   NODE_UNARY, NODE_POSTFIX, NODE_PTR_TYPE index in `unaries`
+ *   NODE_RETURN, NODE_IMPORT                the child node
+ *   NODE_UNIT, NODE_STRUCT_INIT             index in `lists`
+ *   NODE_CALL                               index in `calls`
+ *   NODE_FOR                                index in `fors`
+ *   NODE_WHILE, NODE_IF                     index in `loops`
+ *   NODE_VAR_DECL                           index in `decls`
+ *   NODE_FUNCTION                           index in `functions`
+ *   NODE_STRUCT, NODE_UNION, NODE_ENUM      index in `aggregates`
+ *
+ * Blocks, arguments, initializers and the slices and captures of for
+ * loops are runs of `children`. Every column and table is a stb_ds
+ * dynamic array. Entry 0 of `members` and `variants` is reserved, so 0
+ * ends their lists.
+ *
+ * Offsets are relative to the first token of the top level declaration
+ * the node belongs to, whose offset is in `bases`: an edit moves the
+ * declarations that follow it, never their nodes.
+ */
+typedef struct {
+	u8 *kinds;
+	/* Byte offset from the start of the declaration, see `bases`. */
+	u32 *offsets;
+	u32 *data;
+
+	i64 *integers;
+	f64 *floats;
+	ast_binary *binaries;
+	ast_unary *unaries;
+	ast_list *lists;
+	node_id *children;
+	ast_call *calls;
+	ast_for *fors;
+	ast_loop *loops;
+	ast_decl *decls;
+	ast_function *functions;
+	ast_aggregate *aggregates;
+	member *members;
+	variant *variants;
+	/* Source offset of every top level declaration, in the order of the root. */
+	u32 *bases;
+
+	/* To get back the text of strings and names. */
+	char *source;
+	interner *symbols;
+	/* The cache file the tables live in, see `ast_load()`. */
+	void *mapping;
+	usize mapping_size;
+} ast;
+
+enum {
+	FRAME_BINARY,
+	FRAME_UNARY,
+	FRAME_CAST,
+	FRAME_PAREN,
+};
+
+/* Operator waiting for its right operand in `parse_expression()`. */
+typedef struct {
+	u8 kind;
+	u8 power;
+	/* A `binary_op` or a `unary_op`, depending on the kind. */
+	int op;
+	u32 offset;
+	/* Left operand of binary operators, type of casts. */
+	node_id node;
+} expr_frame;
+
+/* A syntax error, found at `offset` in the source. */
+typedef struct {
+	u32 offset;
+	char *message;
+} diagnostic;
 
 typedef struct {
-	token *tokens;
-	token *previous;
-	ast_node *ast;
+	lexer *lexer;
+	token previous;
+	ast *ast;
+	/* `NODE_UNIT` with the top level declarations. */
+	node_id root;
+	/* Operator stack shared by all the nested expressions. */
+	expr_frame *frames;
+	usize frames_len, frames_cap;
+	/*
+	 * Elements of the lists being parsed, nested lists push on top of
+	 * their parent. A complete list is moved to `children` at once so
+	 * that its elements end up contiguous.
+	 */
+	node_id *scratch;
+	/* Syntax errors in the order they were found. */
+	diagnostic *diagnostics;
+	/* Skip function bodies, see `parser_lazy()`. */
+	bool lazy;
+	/* Offset of the declaration being parsed, new nodes are relative to it. */
+	u32 base;
+	/* Nodes left behind by `parser_edit()`, they are dropped once there are enough. */
+	usize garbage;
 	arena *allocator;
 } parser;
 
+/*
+ * Parse the whole source of `l`. Syntax errors don't stop the parser,
+ * it skips to the next statement and goes on: they are collected in
+ * `diagnostics` in source order, with the errors of the lexer, and when
+ * there are any the AST is incomplete and must not be analyzed or saved.
+ */
 parser *parser_init(lexer *l, arena *allocator);
+/*
+ * Parse the top level declarations on `threads` threads, or one per
+ * CPU when it is 0. The lexer must have tokenized the whole source up
+ * front. The token list is cut at declaration boundaries, every part
+ * is parsed on its own and the results are spliced in source order, so
+ * the AST is the same as with `parser_init()`. When a part fails to
+ * parse the whole source is parsed again serially for the diagnostics.
+ */
+parser *parser_parallel(lexer *l, arena *allocator, usize threads);
+/*
+ * Like `parser_init()`, but function bodies are only matched for
+ * braces and skipped: they are parsed by `parser_body()` the first time
+ * they are needed, so a module costs about as much as its declarations.
+ * The lexer must have tokenized the whole source up front and stay
+ * alive with the parser, a streaming lexer parses everything eagerly.
+ */
+parser *parser_lazy(lexer *l, arena *allocator);
+/*
+ * Return the body of the function `fn`, parsing it first if it was
+ * skipped. Returns 0 when the body has syntax errors, they are added
+ * to `diagnostics`.
+ */
+node_id parser_body(parser *p, node_id fn);
+/*
+ * Apply an edit to the source of `p` and parse again what it touched:
+ * the bytes [start, end) were replaced by `len` bytes, `source` is the
+ * edited text. The text is lexed and parsed again from the top level
+ * declaration before the one around the edit, until a declaration
+ * starts where an old one past the edit did. The others keep their
+ * nodes, as offsets are relative to their declaration only the entries
+ * of the following declarations in `bases` move. So an edit costs the
+ * declarations it touched plus a word per declaration, not the size of
+ * the file, except when the number of declarations changes and the list
+ * of the root is built again.
+ *
+ * The nodes of the replaced declarations are dropped once they make up
+ * half of the tables, which renumbers every node: like the root, node
+ * ids are only valid until the next edit. The first edit of a parser
+ * from `parser_lazy()` parses the skipped bodies from `source` too,
+ * the lexer streams from then on. Returns the new root.
+ * `diagnostics` only has the syntax errors of the parsed declarations
+ * and bodies, and with any the AST is incomplete: the source must be
+ * parsed from scratch before the next edit.
+ */
+node_id parser_edit(parser *p, char *source, usize size, u32 start, u32 end, u32 len);
+/*
+ * Save the AST of `p` to the cache file `path`, parsing the bodies that
+ * `parser_lazy()` skipped first. Nothing is saved with syntax errors.
+ * The file is a header followed by the symbol names and every table as
+ * it is in memory: it holds offsets, never pointers, and only makes
+ * sense on a machine with the same layout, which the header checks.
+ * Returns false on errors.
+ */
+bool ast_save(parser *p, char *path);
+/*
+ * Map the cache file `path` and use its tables in place, instead of
+ * lexing and parsing the source of `l`. `l` must not have produced any
+ * token, the names of the cache are interned in it with the same ids.
+ * Returns NULL when the file is missing, damaged, was written by another
+ * version of lc or for another source, `l` may then hold some of the
+ * names and must be replaced. Every kind and index of the tables is
+ * checked, and that the declarations are trees inside the source, in
+ * passes as long as the tables. The parser can't parse edits or lazy
+ * bodies, and `ast_deinit()` unmaps the file.
+ */
+parser *ast_load(lexer *l, char *path, arena *allocator);
+/* Bytes used by the columns and the side tables of the AST. */
+usize ast_size(ast *a);
+/*
+ * Whether the subtrees `x` of `a` and `y` of `b` have the same nodes at
+ * the same offsets in their declaration, compare `bases` too for whole
+ * ASTs. Names are compared by their text, the two ASTs may have
+ * different interners.
+ */
+bool ast_equal(ast *a, node_id x, ast *b, node_id y);
+/* Free the AST and the tables of `p`, it lives in its arena. */
+void parser_deinit(parser *p);
+void ast_deinit(ast *a);
 
 #endif
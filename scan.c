@@ -0,0 +1,273 @@
+#include "scan.h"
+#include <ctype.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+scanner scan;
+
+static usize scan_whitespace_c(char *s, usize i, usize end)
+{
+	while (i < end && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r' || s[i] == '\v' || s[i] == '\f')) {
+		i += 1;
+	}
+	return i;
+}
+
+static usize scan_line_c(char *s, usize i, usize end)
+{
+	while (i < end && s[i] != '\n' && s[i] != '\0') {
+		i += 1;
+	}
+	return i;
+}
+
+static usize scan_identifier_c(char *s, usize i, usize end)
+{
+	while (i < end && (isalnum((unsigned char)s[i]) || s[i] == '_')) {
+		i += 1;
+	}
+	return i;
+}
+
+static usize scan_string_c(char *s, usize i, usize end)
+{
+	while (i < end && s[i] != '"' && s[i] != '\n' && s[i] != '\0') {
+		i += 1;
+	}
+	return i;
+}
+
+static usize newlines_tail(char *s, usize i, usize end, u32 *starts, usize n)
+{
+	for (; i < end; i++) {
+		if (s[i] != '\n') continue;
+		if (starts) starts[n] = i + 1;
+		n += 1;
+	}
+	return n;
+}
+
+static usize scan_newlines_c(char *s, usize end, u32 *starts)
+{
+	return newlines_tail(s, 0, end, starts, 0);
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Each class function returns a vector where the bytes that belong to
+ * the class are set to 0xff. The scanners then look for the first byte
+ * of the movemask that is out of the run.
+ */
+static __m128i space_sse2(__m128i v)
+{
+	__m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\v')));
+	return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+}
+
+/* Bytes >= 0x80 are negative, so they always fail the range checks. */
+static __m128i identifier_sse2(__m128i v)
+{
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+	return _mm_or_si128(_mm_or_si128(alpha, digit), under);
+}
+
+static usize scan_whitespace_sse2(char *s, usize i, usize end)
+{
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s + i));
+		u32 mask = (u32)_mm_movemask_epi8(space_sse2(v)) ^ 0xffff;
+		if (mask) return i + __builtin_ctz(mask);
+		i += 16;
+	}
+	return scan_whitespace_c(s, i, end);
+}
+
+static usize scan_line_sse2(char *s, usize i, usize end)
+{
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+				_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		u32 mask = (u32)_mm_movemask_epi8(m);
+		if (mask) return i + __builtin_ctz(mask);
+		i += 16;
+	}
+	return scan_line_c(s, i, end);
+}
+
+static usize scan_identifier_sse2(char *s, usize i, usize end)
+{
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s + i));
+		u32 mask = (u32)_mm_movemask_epi8(identifier_sse2(v)) ^ 0xffff;
+		if (mask) return i + __builtin_ctz(mask);
+		i += 16;
+	}
+	return scan_identifier_c(s, i, end);
+}
+
+static usize scan_string_sse2(char *s, usize i, usize end)
+{
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		u32 mask = (u32)_mm_movemask_epi8(m);
+		if (mask) return i + __builtin_ctz(mask);
+		i += 16;
+	}
+	return scan_string_c(s, i, end);
+}
+
+static usize scan_newlines_sse2(char *s, usize end, u32 *starts)
+{
+	usize n = 0;
+	usize i = 0;
+	for (; i + 16 <= end; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s + i));
+		u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		if (!starts) {
+			n += __builtin_popcount(mask);
+			continue;
+		}
+		while (mask) {
+			starts[n++] = i + __builtin_ctz(mask) + 1;
+			mask &= mask - 1;
+		}
+	}
+	return newlines_tail(s, i, end, starts, n);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static __m256i space_avx2(__m256i v)
+{
+	__m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\v')));
+	return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f')));
+}
+
+AVX2 static __m256i identifier_avx2(__m256i v)
+{
+	__m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+	__m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+	return _mm256_or_si256(_mm256_or_si256(alpha, digit), under);
+}
+
+AVX2 static usize scan_whitespace_avx2(char *s, usize i, usize end)
+{
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(s + i));
+		u32 mask = ~(u32)_mm256_movemask_epi8(space_avx2(v));
+		if (mask) return i + __builtin_ctz(mask);
+		i += 32;
+	}
+	return scan_whitespace_sse2(s, i, end);
+}
+
+AVX2 static usize scan_line_avx2(char *s, usize i, usize end)
+{
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(s + i));
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+				_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		u32 mask = (u32)_mm256_movemask_epi8(m);
+		if (mask) return i + __builtin_ctz(mask);
+		i += 32;
+	}
+	return scan_line_sse2(s, i, end);
+}
+
+AVX2 static usize scan_identifier_avx2(char *s, usize i, usize end)
+{
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(s + i));
+		u32 mask = ~(u32)_mm256_movemask_epi8(identifier_avx2(v));
+		if (mask) return i + __builtin_ctz(mask);
+		i += 32;
+	}
+	return scan_identifier_sse2(s, i, end);
+}
+
+AVX2 static usize scan_string_avx2(char *s, usize i, usize end)
+{
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(s + i));
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		u32 mask = (u32)_mm256_movemask_epi8(m);
+		if (mask) return i + __builtin_ctz(mask);
+		i += 32;
+	}
+	return scan_string_sse2(s, i, end);
+}
+
+AVX2 static usize scan_newlines_avx2(char *s, usize end, u32 *starts)
+{
+	usize n = 0;
+	usize i = 0;
+	for (; i + 32 <= end; i += 32) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(s + i));
+		u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		if (!starts) {
+			n += __builtin_popcount(mask);
+			continue;
+		}
+		while (mask) {
+			starts[n++] = i + __builtin_ctz(mask) + 1;
+			mask &= mask - 1;
+		}
+	}
+	return newlines_tail(s, i, end, starts, n);
+}
+
+#endif
+
+void scan_init(void)
+{
+	scan.whitespace = scan_whitespace_c;
+	scan.line = scan_line_c;
+	scan.identifier = scan_identifier_c;
+	scan.string = scan_string_c;
+	scan.newlines = scan_newlines_c;
+
+#ifdef SCAN_X86
+	/* SSE2 is part of the x86-64 baseline. */
+	scan.whitespace = scan_whitespace_sse2;
+	scan.line = scan_line_sse2;
+	scan.identifier = scan_identifier_sse2;
+	scan.string = scan_string_sse2;
+	scan.newlines = scan_newlines_sse2;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan.whitespace = scan_whitespace_avx2;
+		scan.line = scan_line_avx2;
+		scan.identifier = scan_identifier_avx2;
+		scan.string = scan_string_avx2;
+		scan.newlines = scan_newlines_avx2;
+	}
+#endif
+}
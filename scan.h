@@ -0,0 +1,39 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "utils.h"
+
+/*
+ * Byte scanners used by the lexer hot loop. Every scanner starts at
+ * `i` and returns the index of the first byte that doesn't belong to
+ * the run, or `end` if the run reaches it. Nothing past `end` is ever
+ * read, so the vector paths fall back to bytewise scanning for the
+ * last few bytes of the buffer.
+ */
+typedef struct {
+	/* Spaces, tabs, newlines, `\r`, `\v` and `\f`. */
+	usize (*whitespace)(char *s, usize i, usize end);
+	/* Stops at `\n` or `\0`. */
+	usize (*line)(char *s, usize i, usize end);
+	/* Letters, digits and `_`. */
+	usize (*identifier)(char *s, usize i, usize end);
+	/* Stops at `"`, `\n` or `\0`. */
+	usize (*string)(char *s, usize i, usize end);
+	/*
+	 * Count the newlines in [0, end). When `starts` is not null the
+	 * offset following each of them is stored there too.
+	 */
+	usize (*newlines)(char *s, usize end, u32 *starts);
+} scanner;
+
+extern scanner scan;
+
+/*
+ * Select the widest implementation supported by the running CPU
+ * (AVX2, SSE2 or plain C). It writes `scan`, so it must not run while
+ * another thread scans: the lexer calls it once, when the first lexer
+ * is created.
+ */
+void scan_init(void);
+
+#endif
@@ -1,64 +1,100 @@
-#define STB_DS_IMPLEMENTATION
 #include "sema.h"
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 typedef struct _res_node {
-	struct _res_node **in;
+	/* Number of types it depends on that are not created yet. */
+	u32 in;
+	/* Index in `types`. */
+	u32 id;
 	struct _res_node **out;
 	type *value;
 } res_node;
 
-typedef struct { res_node node; bool complete; } pair;
+typedef struct { res_node node; bool complete; node_id decl; u32 base; } pair;
 
 typedef struct { u8 flags; char *name; } type_key;
 
-static struct { char *key; pair *value; } *types;
-static struct { char *key; type *value; } *type_reg;
-
-static struct { char *key; prototype *value; } *prototypes;
-
-static scope *global_scope = NULL;
-static scope *current_scope = NULL;
-static type *current_return = NULL;
-
-static type *const_int = NULL;
-static type *const_float = NULL;
-
-static bool in_loop = false;
-
-/* Print the error message and sync the parser. */
-static void error(ast_node *n, char *msg)
+/* What tells pointer and slice types apart, see `intern_type()`. */
+typedef struct {
+	type *child;
+	usize len;
+	type_tag tag;
+	/* `PTR_CONST` and `PTR_VOLATILE`. */
+	u8 flags;
+} type_shape;
+
+struct shape_entry { type_shape key; type *value; };
+
+struct sema_context {
+	/* The named types and what depends on them, see `create_types()`. */
+	struct { u32 key; pair *value; } *types;
+	struct { u32 key; type *value; } *type_reg;
+	struct { u32 key; prototype *value; } *prototypes;
+	struct shape_entry *shapes;
+	/* The only table that grows while the functions are checked. */
+	pthread_mutex_t shapes_lock;
+	type *const_int;
+	type *const_float;
+};
+
+static void print_error(sema *s, node_id n, u32 base, char *msg)
 {
 	if (n) {
-		printf("\x1b[31m\x1b[1merror\x1b[0m\x1b[1m:%ld:%ld:\x1b[0m %s\n", n->position.row, n->position.column, msg);
+		source_pos pos = lexer_locate(s->lexer, base + s->ast->offsets[n]);
+		printf("\x1b[31m\x1b[1merror\x1b[0m\x1b[1m:%ld:%ld:\x1b[0m %s\n", pos.row, pos.column, msg);
 	} else {
 		printf("\x1b[31m\x1b[1merror\x1b[0m\x1b[1m:\x1b[0m %s\n", msg);
 	}
 }
 
-static char *intern_string(sema *s, char *str, usize len)
+/* Print the error message, or keep it for later on a worker. */
+static void error(sema *s, node_id n, char *msg)
+{
+	if (s->deferred) {
+		sema_error e = { n, s->base, msg };
+		arrput(s->errors, e);
+	} else {
+		print_error(s, n, s->base, msg);
+	}
+}
+
+/*
+ * Index of `key` in a table the workers share, or -1. Unlike `hmget()`
+ * this only reads the table.
+ */
+static ptrdiff_t shared_index(void *table, usize size, u32 key)
+{
+	ptrdiff_t index;
+	stbds_hmget_key_ts(table, size, &key, sizeof(key), &index, STBDS_HM_BINARY);
+	return index;
+}
+
+/* Entry -1 is the default, NULL. */
+#define lookup(table, key) ((table) ? (table)[shared_index((table), sizeof(*(table)), (key))].value : NULL)
+
+/* Look up one of the types registered by `sema_init()`. */
+static type *builtin(sema *s, char *name)
 {
-	(void) s;
-	char *ptr = malloc(len + 1);
-	memcpy(ptr, str, len);
-	ptr[len] = '\0';
-	return ptr;
+	return lookup(s->shared->type_reg, intern(s->symbols, name, strlen(name)));
 }
 
 static type *create_integer(sema *s, char *name, u8 bits, bool sign)
 {
 	type *t = arena_alloc(s->allocator, sizeof(type));
 	t->name = name;
+	t->symbol = intern(s->symbols, name, strlen(name));
 	t->tag = sign ? TYPE_INTEGER : TYPE_UINTEGER;
 	t->data.integer = bits;
 	
 	pair *graph_node = arena_alloc(s->allocator, sizeof(pair));
 	graph_node->node.value = t;
-	graph_node->node.in = NULL;
+	graph_node->node.in = 0;
 	graph_node->node.out = NULL;
 
-	shput(types, name, graph_node);
+	hmput(s->shared->types, t->symbol, graph_node);
 	return t;
 }
 
@@ -66,124 +102,161 @@ static type *create_float(sema *s, char *name, u8 bits)
 {
 	type *t = arena_alloc(s->allocator, sizeof(type));
 	t->name = name;
+	t->symbol = intern(s->symbols, name, strlen(name));
 	t->tag = TYPE_FLOAT;
 	t->data.flt = bits;
 	
 	pair *graph_node = arena_alloc(s->allocator, sizeof(pair));
 	graph_node->node.value = t;
-	graph_node->node.in = NULL;
+	graph_node->node.in = 0;
 	graph_node->node.out = NULL;
 
-	shput(types, name, graph_node);
+	hmput(s->shared->types, t->symbol, graph_node);
 	return t;
 }
 
 /* https://en.wikipedia.org/wiki/Topological_sorting */
-static void order_type(sema *s, ast_node *node)
+static void order_type(sema *s, node_id node)
 {
-	if (node->type == NODE_STRUCT || node->type == NODE_UNION) {
+	ast *a = s->ast;
+	if (a->kinds[node] == NODE_STRUCT || a->kinds[node] == NODE_UNION) {
+		ast_aggregate *structure = &a->aggregates[a->data[node]];
 		type *t = arena_alloc(s->allocator, sizeof(type));
-		t->tag = node->type == NODE_STRUCT ? TYPE_STRUCT : TYPE_UNION;
-		t->data.structure.name = node->expr.structure.name;
-		t->data.structure.name_len = node->expr.structure.name_len;
-		t->data.structure.members = node->expr.structure.members;
+		t->tag = a->kinds[node] == NODE_STRUCT ? TYPE_STRUCT : TYPE_UNION;
+		t->data.structure.members = structure->first;
 		
-		char *k = intern_string(s, node->expr.structure.name, node->expr.structure.name_len);
-		t->name = k;
-		pair *graph_node = shget(types, k);
+		u32 k = structure->symbol;
+		t->name = symbol_name(s->symbols, k);
+		t->symbol = k;
+		pair *graph_node = hmget(s->shared->types, k);
 		
 		if (!graph_node) {
 			graph_node = arena_alloc(s->allocator, sizeof(pair));
-			graph_node->node.in = NULL;
+			graph_node->node.in = 0;
 			graph_node->node.out = NULL;
 		} else if (graph_node->complete) {
-			error(node, "type already defined.");
+			error(s, node, "type already defined.");
 			return;
 		}
 		graph_node->node.value = t;
+		graph_node->decl = node;
+		graph_node->base = s->base;
+		/* Before the members, one may be of the type itself. */
+		hmput(s->shared->types, k, graph_node);
 
-		member *m = t->data.structure.members;
+		u32 m = t->data.structure.members;
 		while (m) {
-			if (m->type->type != NODE_IDENTIFIER) {
-				m = m->next;
+			if (a->kinds[a->members[m].type] != NODE_IDENTIFIER) {
+				m = a->members[m].next;
 				continue;
 			}
-			char *name = intern_string(s, m->type->expr.string.start, m->type->expr.string.len);
-			pair *p = shget(types, name);
+			u32 name = a->data[a->members[m].type];
+			pair *p = hmget(s->shared->types, name);
 			if (!p) {
 				p = arena_alloc(s->allocator, sizeof(pair));
 				p->node.out = NULL;
-				p->node.in = NULL;
+				p->node.in = 0;
 				p->node.value = NULL;
 				p->complete = false;
-				shput(types, name, p);
+				hmput(s->shared->types, name, p);
 			}
 
-			arrput(graph_node->node.in, &p->node);
+			graph_node->node.in += 1;
 			arrput(p->node.out, &graph_node->node);
 
-			m = m->next;
+			m = a->members[m].next;
 		}
 
-		shput(types, k, graph_node);
 		graph_node->complete = true;
 	}
 }
 
-static type *get_type(sema *s, ast_node *n)
+/*
+ * Return the one pointer or slice type with this shape, so that they
+ * can be compared by address like the named types. The shared table
+ * is locked only for the shapes the thread hasn't used yet, the others
+ * are in its own `shapes`.
+ */
+static type *intern_type(sema *s, type_tag tag, type *child, u8 flags, usize len)
 {
-	char *name = NULL;
-	type *t = NULL;
-	switch (n->type) {
+	type_shape key;
+	/* The padding is hashed too. */
+	memset(&key, 0x0, sizeof(key));
+	key.child = child;
+	key.len = len;
+	key.tag = tag;
+	key.flags = flags;
+	type *t = hmget(s->shapes, key);
+	if (t) return t;
+
+	pthread_mutex_lock(&s->shared->shapes_lock);
+	t = hmget(s->shared->shapes, key);
+	if (t) {
+		pthread_mutex_unlock(&s->shared->shapes_lock);
+		hmput(s->shapes, key, t);
+		return t;
+	}
+
+	t = arena_alloc(s->allocator, sizeof(type));
+	memset(t, 0x0, sizeof(type));
+	t->tag = tag;
+	t->size = sizeof(usize);
+	t->alignment = sizeof(usize);
+	if (tag == TYPE_PTR) {
+		t->name = "ptr";
+		t->data.ptr.child = child;
+		t->data.ptr.is_const = (flags & PTR_CONST) != 0;
+		t->data.ptr.is_volatile = (flags & PTR_VOLATILE) != 0;
+	} else {
+		t->name = "slice";
+		t->data.slice.child = child;
+		t->data.slice.len = len;
+		t->data.slice.is_const = (flags & PTR_CONST) != 0;
+		t->data.slice.is_volatile = (flags & PTR_VOLATILE) != 0;
+	}
+	hmput(s->shared->shapes, key, t);
+	pthread_mutex_unlock(&s->shared->shapes_lock);
+	hmput(s->shapes, key, t);
+	return t;
+}
+
+static type *get_type(sema *s, node_id n)
+{
+	ast *a = s->ast;
+	ast_unary *ptr;
+	switch (a->kinds[n]) {
 		case NODE_IDENTIFIER:
-			name = intern_string(s, n->expr.string.start, n->expr.string.len);
-			t = shget(type_reg, name);
-			free(name);
-			return t;
+			return lookup(s->shared->type_reg, a->data[n]);
 		case NODE_PTR_TYPE:
-			t = malloc(sizeof(type));
-			t->size = sizeof(usize);
-			t->alignment = sizeof(usize);
-			if (n->expr.ptr_type.flags & PTR_RAW) {
-				t->name = "ptr";
-				t->tag = TYPE_PTR;
-				t->data.ptr.child = get_type(s, n->expr.ptr_type.type);
-				t->data.ptr.is_const = (n->expr.ptr_type.flags & PTR_CONST) != 0;
-				t->data.ptr.is_volatile = (n->expr.ptr_type.flags & PTR_VOLATILE) != 0;
-			} else {
-				t->name = "slice";
-				t->tag = TYPE_SLICE;
-				t->data.slice.child = get_type(s, n->expr.ptr_type.type);
-				t->data.slice.is_const = (n->expr.ptr_type.flags & PTR_CONST) != 0;
-				t->data.slice.is_volatile = (n->expr.ptr_type.flags & PTR_VOLATILE) != 0;
-			}
-			return t;
+			ptr = &a->unaries[a->data[n]];
+			return intern_type(s, ptr->op & PTR_RAW ? TYPE_PTR : TYPE_SLICE, get_type(s, ptr->operand),
+					ptr->op & (PTR_CONST | PTR_VOLATILE), 0);
 		default:
-			error(n, "expected type.");
+			error(s, n, "expected type.");
 			return NULL;
 	}
 }
 
-static void register_struct(sema *s, char *name, type *t)
+static void register_struct(sema *s, type *t)
 {
 	usize alignment = 0;
-	member *m = t->data.structure.members;
+	member *members = s->ast->members;
+	u32 m = t->data.structure.members;
 
 	usize offset = 0;
 	type *m_type = NULL;
 	while (m) {
-		m_type = get_type(s, m->type);
+		m_type = get_type(s, members[m].type);
 
 		if (!m_type) {
-			error(m->type, "unknown type.");
+			error(s, members[m].type, "unknown type.");
 			return;
 		}
 
-		char *n = intern_string(s, m->name, m->name_len);
-		shput(t->data.structure.member_types, n, m_type);
+		hmput(t->data.structure.member_types, members[m].symbol, m_type);
 
 		if (m_type->size == 0) {
-			error(m->type, "a struct member can't be of type `void`.");
+			error(s, members[m].type, "a struct member can't be of type `void`.");
 			return;
 		}
 
@@ -193,10 +266,10 @@ static void register_struct(sema *s, char *name, type *t)
 
 		usize padding = (m_type->alignment - (offset % m_type->alignment)) % m_type->alignment;
 		offset += padding;
-		m->offset = offset;
+		members[m].offset = offset;
 		offset += m_type->size;
 
-		m = m->next;
+		m = members[m].next;
 	}
 
 	t->alignment = alignment;
@@ -209,21 +282,21 @@ static void register_struct(sema *s, char *name, type *t)
 	t->size = offset;
 }
 
-static void register_union(sema *s, char *name, type *t)
+static void register_union(sema *s, type *t)
 {
 	usize alignment = 0;
 	usize size = 0;
-	member *m = t->data.structure.members;
+	member *members = s->ast->members;
+	u32 m = t->data.structure.members;
 	while (m) {
-		type *m_type = get_type(s, m->type);
+		type *m_type = get_type(s, members[m].type);
 		
 		if (!m_type) {
-			error(m->type, "unknown type.");
+			error(s, members[m].type, "unknown type.");
 			return;
 		}
 
-		char *n = intern_string(s, m->name, m->name_len);
-		shput(t->data.structure.member_types, n, m_type);
+		hmput(t->data.structure.member_types, members[m].symbol, m_type);
 
 		if (alignment < m_type->alignment) {
 			alignment = m_type->alignment;
@@ -233,14 +306,14 @@ static void register_union(sema *s, char *name, type *t)
 			size = m_type->size;
 		}
 		
-		m = m->next;
+		m = members[m].next;
 	}
 
 	t->alignment = alignment;
 	t->size = size;
 }
 
-static void register_type(sema *s, char *name, type *t)
+static void register_type(sema *s, type *t)
 {
 	switch (t->tag) {
 		case TYPE_INTEGER:
@@ -257,168 +330,250 @@ static void register_type(sema *s, char *name, type *t)
 			t->alignment = t->data.flt / 8;
 			break;
 		case TYPE_STRUCT:
-			register_struct(s, name, t);
+			register_struct(s, t);
 			break;
 		case TYPE_UNION:
-			register_union(s, name, t);
+			register_union(s, t);
 			break;
 		default:
-			error(NULL, "registering an invalid type.");
+			error(s, 0, "registering an invalid type.");
 			return;
 	}
 
-	shput(type_reg, name, t);
+	hmput(s->shared->type_reg, t->symbol, t);
 }
 
-static void create_types(sema *s)
+typedef struct {
+	u32 node;
+	u32 edge;
+} visit;
+
+static void append(char **msg, char *str)
 {
-	res_node **nodes = NULL;
-	res_node **ordered = NULL;
-	usize node_count = shlen(types);
-	for (int i=0; i < node_count; i++) {
-		if (arrlen(types[i].value->node.in) == 0) {
-			arrput(nodes, &types[i].value->node);
-		}
-	}
+	usize len = strlen(str);
+	memcpy(arraddnptr(*msg, len), str, len);
+}
 
-	while (arrlen(nodes) > 0) {
-		res_node *n = nodes[0];
-		arrdel(nodes, 0);
-		arrput(ordered, n);
-		while (arrlen(n->out) > 0) {
-			res_node *dep = n->out[0];
-			arrdel(n->out, 0);
-			
-			for (int j=0; j < arrlen(dep->in); j++) {
-				if (dep->in[j] == n) {
-					arrdel(dep->in, j);
+/*
+ * Report every group of types that depend on each other, they are the
+ * strongly connected components of what `create_types()` left behind.
+ * https://en.wikipedia.org/wiki/Tarjan%27s_strongly_connected_components_algorithm
+ */
+static void report_cycles(sema *s)
+{
+	usize count = hmlen(s->shared->types);
+	/* Visit order from 1, 0 when not visited yet. */
+	u32 *index = calloc(count, sizeof(u32));
+	u32 *low = calloc(count, sizeof(u32));
+	bool *stacked = calloc(count, sizeof(bool));
+	u32 *stack = NULL;
+	visit *calls = NULL;
+	char *msg = NULL;
+	u32 visited = 0;
+
+	for (usize root = 0; root < count; root++) {
+		/* Only the types that were not created can be part of a cycle. */
+		if (index[root] || s->shared->types[root].value->node.in == 0) continue;
+		index[root] = low[root] = ++visited;
+		arrput(stack, root);
+		stacked[root] = true;
+		arrput(calls, ((visit){ root, 0 }));
+
+		while (arrlen(calls) > 0) {
+			visit *c = &arrlast(calls);
+			res_node *n = &s->shared->types[c->node].value->node;
+			if (c->edge < arrlen(n->out)) {
+				u32 w = n->out[c->edge++]->id;
+				if (!index[w]) {
+					index[w] = low[w] = ++visited;
+					arrput(stack, w);
+					stacked[w] = true;
+					arrput(calls, ((visit){ w, 0 }));
+				} else if (stacked[w] && index[w] < low[c->node]) {
+					low[c->node] = index[w];
 				}
+				continue;
 			}
 
-			if (arrlen(dep->in) == 0) {
-				arrput(nodes, dep);
+			u32 v = arrpop(calls).node;
+			if (arrlen(calls) > 0 && low[v] < low[arrlast(calls).node]) {
+				low[arrlast(calls).node] = low[v];
+			}
+			if (low[v] != index[v]) continue;
+
+			/* `v` is the first visited type of a component. */
+			usize first = arrlen(stack);
+			while (stack[first - 1] != v) first--;
+			first--;
+			bool cycle = arrlen(stack) - first > 1;
+			for (u32 e = 0; !cycle && e < arrlen(n->out); e++) {
+				cycle = n->out[e] == n;
 			}
+			if (cycle) {
+				arrsetlen(msg, 0);
+				for (usize i = first; i < arrlen(stack); i++) {
+					u32 symbol = s->shared->types[stack[i]].key;
+					append(&msg, i == first ? "cycling struct definition: `" : ", `");
+					memcpy(arraddnptr(msg, symbol_len(s->symbols, symbol)), symbol_name(s->symbols, symbol),
+							symbol_len(s->symbols, symbol));
+					append(&msg, "`");
+				}
+				append(&msg, ".");
+				arrput(msg, '\0');
+				s->base = s->shared->types[v].value->base;
+				error(s, s->shared->types[v].value->decl, msg);
+			}
+			for (usize i = first; i < arrlen(stack); i++) {
+				stacked[stack[i]] = false;
+			}
+			arrsetlen(stack, first);
 		}
 	}
 
-	if (arrlen(ordered) < node_count) {
-		error(NULL, "cycling struct definition.");
+	arrfree(msg);
+	arrfree(calls);
+	arrfree(stack);
+	free(stacked);
+	free(low);
+	free(index);
+}
+
+/* https://en.wikipedia.org/wiki/Topological_sorting */
+static void create_types(sema *s)
+{
+	usize count = hmlen(s->shared->types);
+	/* The types in the order they are created, the queue of Kahn's algorithm. */
+	u32 *ordered = NULL;
+	for (usize i = 0; i < count; i++) {
+		s->shared->types[i].value->node.id = i;
+		if (s->shared->types[i].value->node.in == 0) {
+			arrput(ordered, i);
+		}
+	}
+
+	for (usize head = 0; head < arrlen(ordered); head++) {
+		res_node *n = &s->shared->types[ordered[head]].value->node;
+		for (u32 e = 0; e < arrlen(n->out); e++) {
+			if (--n->out[e]->in == 0) {
+				arrput(ordered, n->out[e]->id);
+			}
+		}
+	}
+
+	if (arrlen(ordered) < count) {
+		report_cycles(s);
 	}
 
-	for (int i=0; i < arrlen(ordered); i++) {
-		type *t = ordered[i]->value;
+	for (usize i = 0; i < arrlen(ordered); i++) {
+		pair *pr = s->shared->types[ordered[i]].value;
+		type *t = pr->node.value;
 		if (t && (t->tag == TYPE_STRUCT || t->tag == TYPE_UNION)) {
-			char *name = t->name;
-			register_type(s, name, t);
+			s->base = pr->base;
+			register_type(s, t);
 		}
 	}
+	arrfree(ordered);
 }
 
-static void create_prototype(sema *s, ast_node *node)
+static void create_prototype(sema *s, node_id node)
 {
+	ast *a = s->ast;
+	ast_function *fn = &a->functions[a->data[node]];
 	prototype *p = arena_alloc(s->allocator, sizeof(prototype));
-	p->name = intern_string(s, node->expr.function.name, node->expr.function.name_len);
-	if (shget(prototypes, p->name)) {
-		error(node, "function already defined.");
+	p->symbol = fn->symbol;
+	p->name = symbol_name(s->symbols, p->symbol);
+	if (hmget(s->shared->prototypes, p->symbol)) {
+		error(s, node, "function already defined.");
 	}
 
-	member *m = node->expr.function.parameters;
+	u32 m = fn->params;
 	while (m) {
-		type *t = get_type(s, m->type);
+		type *t = get_type(s, a->members[m].type);
 		if (!t) {
-			error(m->type, "unknown type.");
+			error(s, a->members[m].type, "unknown type.");
 			return;
 		}
 
 		arrput(p->parameters, t);
-		m = m->next;
+		m = a->members[m].next;
 	}
 
-	p->type = get_type(s, node->expr.function.type);
-	shput(prototypes, p->name, p);
+	p->type = get_type(s, fn->type);
+	hmput(s->shared->prototypes, p->symbol, p);
 }
 
 static void push_scope(sema *s)
 {
-	scope *scp = arena_alloc(s->allocator, sizeof(scope));
-	scp->parent = current_scope;
-	current_scope = scp;
+	arrput(s->scopes, arrlen(s->bindings));
 }
 
+/* Bring back the declarations hidden by the ones of the scope. */
 static void pop_scope(sema *s)
 {
-	current_scope = current_scope->parent;
+	usize start = arrpop(s->scopes);
+	while (arrlen(s->bindings) > start) {
+		binding b = arrpop(s->bindings);
+		s->visible[b.symbol] = b.shadowed;
+	}
 }
 
-static type *get_def(sema *s, char *name)
+static void define(sema *s, u32 name, type *t)
 {
-	scope *current = current_scope;
-	while (current) {
-		type *t = shget(current->defs, name);
-		if (t) return t;
-
-		current = current->parent;
+	if (name >= arrlen(s->visible)) {
+		usize len = arrlen(s->visible);
+		arrsetlen(s->visible, name + 1);
+		memset(s->visible + len, 0x0, (name + 1 - len) * sizeof(type *));
 	}
+	binding b = { name, s->visible[name] };
+	arrput(s->bindings, b);
+	s->visible[name] = t;
+}
 
-	return NULL;
+static type *get_def(sema *s, u32 name)
+{
+	return name < arrlen(s->visible) ? s->visible[name] : NULL;
 }
 
-static type *get_string_type(sema *s, ast_node *node)
+static type *get_string_type(sema *s, node_id node)
 {
-	type *string_type = arena_alloc(s->allocator, sizeof(type));
-	string_type->tag = TYPE_PTR;
-	string_type->size = sizeof(usize);
-	string_type->alignment = sizeof(usize);
-	string_type->name = "slice";
-	string_type->data.slice.child = shget(type_reg, "u8");
-	string_type->data.slice.is_const = true;
-	string_type->data.slice.is_volatile = false;
-	string_type->data.slice.len = node->expr.string.len;
-	return string_type;
+	return intern_type(s, TYPE_SLICE, builtin(s, "u8"), PTR_CONST, s->ast->data[node]);
 }
 
-static type *get_range_type(sema *s, ast_node *node)
+static type *get_range_type(sema *s, node_id node)
 {
-	type *range_type = arena_alloc(s->allocator, sizeof(type));
-	range_type->tag = TYPE_PTR;
-	range_type->size = sizeof(usize);
-	range_type->alignment = sizeof(usize);
-	range_type->name = "slice";
-	range_type->data.slice.child = shget(type_reg, "usize");
-	range_type->data.slice.is_const = true;
-	range_type->data.slice.is_volatile = false;
-	range_type->data.slice.len = node->expr.binary.right->expr.integer - node->expr.binary.left->expr.integer;
-	return range_type;
+	ast *a = s->ast;
+	ast_binary *range = &a->binaries[a->data[node]];
+	usize len = a->integers[a->data[range->right]] - a->integers[a->data[range->left]];
+	return intern_type(s, TYPE_SLICE, builtin(s, "usize"), PTR_CONST, len);
 }
 
-static type *get_expression_type(sema *s, ast_node *node);
-static type *get_access_type(sema *s, ast_node *node)
+static type *get_expression_type(sema *s, node_id node);
+static type *get_access_type(sema *s, node_id node)
 {
-	type *t = get_expression_type(s, node->expr.access.expr);
-	ast_node *member = node->expr.access.member;
-	char *name_start = member->expr.string.start;
-	usize name_len = member->expr.string.len;
+	ast_binary *access = &s->ast->binaries[s->ast->data[node]];
+	node_id member = access->right;
+	type *t = get_expression_type(s, access->left);
 	if (!t || (t->tag != TYPE_STRUCT && t->tag != TYPE_UNION)) {
-		error(node, "invalid expression.");
+		error(s, node, "invalid expression.");
 		return NULL;
 	}
-	char *name = intern_string(s, name_start, name_len);
-	type *res = shget(t->data.structure.member_types, name);
+	type *res = lookup(t->data.structure.member_types, s->ast->data[member]);
 	if (!res) {
-		error(node, "struct doesn't have that member");
+		error(s, node, "struct doesn't have that member");
 		return NULL;
 	}
 
 	return res;
 }
 
-static type *get_identifier_type(sema *s, ast_node *node)
+static type *get_identifier_type(sema *s, node_id node)
 {
-	char *name_start = node->expr.string.start;
-	usize name_len = node->expr.string.len;
-	type *t = get_def(s, intern_string(s, name_start, name_len));
-	if (!t) {
-		error(node, "unknown identifier.");
+	type *t = get_def(s, s->ast->data[node]);
+	if (!t && lookup(s->shared->type_reg, s->ast->data[node])) {
+		/* Most likely `(name)-x`, see `builtin_type()` in the parser. */
+		error(s, node, "type used as a value, cast `-x`, `*x` or `&x` as `(type)(-x)`.");
+	} else if (!t) {
+		error(s, node, "unknown identifier.");
 	}
 	return t;
 }
@@ -440,71 +595,88 @@ static bool can_cast(type *source, type *dest)
 	}
 }
 
-static type *get_expression_type(sema *s, ast_node *node)
+static type *resolve_expression_type(sema *s, node_id node)
 {
-	if (!node) {
-		return shget(type_reg, "void");
-	}
-
+	ast *a = s->ast;
 	type *t = NULL;
 	prototype *prot = NULL;
-	switch (node->type) {
+	ast_binary *binary = NULL;
+	switch (a->kinds[node]) {
 		case NODE_IDENTIFIER:
 			return get_identifier_type(s, node);
 		case NODE_INTEGER:
-			return const_int;
+			return s->shared->const_int;
 		case NODE_FLOAT:
-			return const_float;
+			return s->shared->const_float;
 		case NODE_STRING:
 			return get_string_type(s, node);
 		case NODE_CHAR:
-			return shget(type_reg, "u8");
+			return builtin(s, "u8");
 		case NODE_BOOL:
-			return shget(type_reg, "bool");
+			return builtin(s, "bool");
 		case NODE_CAST:
-			return get_type(s, node->expr.cast.type);
+			return get_type(s, a->binaries[a->data[node]].right);
 		case NODE_POSTFIX:
 		case NODE_UNARY:
-			return get_expression_type(s, node->expr.unary.right);
+			return get_expression_type(s, a->unaries[a->data[node]].operand);
 		case NODE_BINARY:
-			t = get_expression_type(s, node->expr.binary.left);
+			binary = &a->binaries[a->data[node]];
+			t = get_expression_type(s, binary->left);
 			if (!t) return NULL;
-			if (!match(t, get_expression_type(s, node->expr.binary.right))) {
-				error(node, "type mismatch.");
+			if (!match(t, get_expression_type(s, binary->right))) {
+				error(s, node, "type mismatch.");
 				return NULL;
 			}
-			if (node->expr.binary.operator >= OP_EQ) {
-				return shget(type_reg, "bool");
-			} else if (node->expr.binary.operator >= OP_ASSIGN && node->expr.binary.operator <= OP_MOD_EQ) {
-				return shget(type_reg, "void");
+			if (binary->op >= OP_EQ) {
+				return builtin(s, "bool");
+			} else if (binary->op >= OP_ASSIGN && binary->op <= OP_MOD_EQ) {
+				return builtin(s, "void");
 			} else {
 				return t;
 			}
 		case NODE_RANGE:
 			return get_range_type(s, node);
 		case NODE_ARRAY_SUBSCRIPT:
-			t = get_expression_type(s, node->expr.subscript.expr);
+			t = get_expression_type(s, a->binaries[a->data[node]].left);
 			switch (t->tag) {
 				case TYPE_SLICE:
 					return t->data.slice.child;
 				case TYPE_PTR:
 					return t->data.ptr.child;
 				default:
-					error(node, "only pointers and slices can be indexed.");
+					error(s, node, "only pointers and slices can be indexed.");
 					return NULL;
 			}
 		case NODE_CALL:
-			prot = shget(prototypes, intern_string(s, node->expr.call.name, node->expr.call.name_len));
+			prot = lookup(s->shared->prototypes, a->calls[a->data[node]].symbol);
 			if (!prot) {
-				error(node, "unknown function.");
+				error(s, node, "unknown function.");
 				return NULL;
 			}
 			return prot->type;
 		case NODE_ACCESS:
 			return get_access_type(s, node);
 		default:
-			return shget(type_reg, "void");
+			return builtin(s, "void");
+	}
+}
+
+/* What `expr_types` holds for the expressions that have no type. */
+static type untyped;
+
+/* The type of an expression, resolved and checked only the first time. */
+static type *get_expression_type(sema *s, node_id node)
+{
+	if (!node) {
+		return builtin(s, "void");
+	}
+
+	type *t = s->expr_types[node];
+	if (!t) {
+		t = resolve_expression_type(s, node);
+		s->expr_types[node] = t ? t : &untyped;
 	}
+	return t == &untyped ? NULL : t;
 }
 
 static bool match(type *t1, type *t2)
@@ -516,10 +688,9 @@ static bool match(type *t1, type *t2)
 		case TYPE_VOID:
 		case TYPE_BOOL:
 			return true;
+		/* Pointers and slices are interned, structs are unique. */
 		case TYPE_PTR:
-			return (t1->data.ptr.is_const == t2->data.ptr.is_const) && (t1->data.ptr.is_volatile == t2->data.ptr.is_volatile) && match(t1->data.ptr.child, t2->data.ptr.child);
 		case TYPE_SLICE:
-			return (t1->data.slice.is_const == t2->data.slice.is_const) && (t1->data.slice.is_volatile == t2->data.slice.is_volatile) && match(t1->data.slice.child, t2->data.slice.child) && t1->data.slice.len == t2->data.slice.len;
 		case TYPE_STRUCT:
 		case TYPE_UNION:
 			return t1 == t2;
@@ -540,91 +711,89 @@ static bool match(type *t1, type *t2)
 	return false;
 }
 
-static void check_statement(sema *s, ast_node *node);
-static void check_body(sema *s, ast_node *node)
+static void check_statement(sema *s, node_id node);
+static void check_body(sema *s, node_id node)
 {
+	ast *a = s->ast;
 	push_scope(s);
 
-	ast_node *current = node;
-	while (current && current->type == NODE_UNIT) {
-		check_statement(s, current->expr.unit_node.expr);
-		current = current->expr.unit_node.next;
+	ast_list body = node ? a->lists[a->data[node]] : (ast_list){ 0 };
+	for (u32 i=0; i < body.len; i++) {
+		check_statement(s, a->children[body.start + i]);
 	}
 
 	pop_scope(s);
 }
 
-static void check_for(sema *s, ast_node *node)
+static void check_for(sema *s, node_id node)
 {
-	ast_node *slices = node->expr.fr.slices;
-	ast_node *captures = node->expr.fr.captures;
+	ast *a = s->ast;
+	ast_for *fr = &a->fors[a->data[node]];
 
 	push_scope(s);
 
-	ast_node *current_capture = captures;
-	ast_node *current_slice = slices;
-
-	while (current_capture) {
-		type *c_type = get_expression_type(s, current_slice->expr.unit_node.expr);
-		char *c_name = intern_string(s, current_capture->expr.unit_node.expr->expr.string.start, current_capture->expr.unit_node.expr->expr.string.len);
-		shput(current_scope->defs, c_name, c_type);
-		current_capture = current_capture->expr.unit_node.next;
-		current_slice = current_slice->expr.unit_node.next;
+	for (u32 i=0; i < fr->capture_len; i++) {
+		type *c_type = get_expression_type(s, a->children[fr->slices + i]);
+		u32 c_name = a->data[a->children[fr->captures + i]];
+		define(s, c_name, c_type);
 	}
 
-	ast_node *current = node->expr.fr.body;
+	ast_list body = fr->body ? a->lists[a->data[fr->body]] : (ast_list){ 0 };
 
-	in_loop = true;
-	while (current && current->type == NODE_UNIT) {
-		check_statement(s, current->expr.unit_node.expr);
-		current = current->expr.unit_node.next;
+	s->in_loop = true;
+	for (u32 i=0; i < body.len; i++) {
+		check_statement(s, a->children[body.start + i]);
 	}
-	in_loop = false;
+	s->in_loop = false;
 
 	pop_scope(s);
 }
 
-static void check_statement(sema *s, ast_node *node)
+static void check_statement(sema *s, node_id node)
 {
 	if (!node) return;
 
-	type *t = NULL;
-	char *name = NULL;
-	switch(node->type) {
+	ast *a = s->ast;
+	type *t = NULL, *value = NULL;
+	u32 name = 0;
+	ast_decl *decl = NULL;
+	switch(a->kinds[node]) {
 		case NODE_RETURN:
-			if (!match(get_expression_type(s, node->expr.ret.value), current_return)) {
-				error(node, "return type doesn't match function's one.");
+			if (!match(get_expression_type(s, a->data[node]), s->current_return)) {
+				error(s, node, "return type doesn't match function's one.");
 			}
 			break;
 		case NODE_BREAK:
-			if (!in_loop) {
-				error(node, "`break` isn't in a loop.");
+			if (!s->in_loop) {
+				error(s, node, "`break` isn't in a loop.");
 			}
 			break;
 		case NODE_WHILE:
-			if (!match(get_expression_type(s, node->expr.whle.condition), shget(type_reg, "bool"))) {
-				error(node, "expected boolean value.");
+			if (!match(get_expression_type(s, a->loops[a->data[node]].condition), builtin(s, "bool"))) {
+				error(s, node, "expected boolean value.");
 				return;
 			}
 
-			in_loop = true;
-			check_body(s, node->expr.whle.body);
-			in_loop = false;
+			s->in_loop = true;
+			check_body(s, a->loops[a->data[node]].body);
+			s->in_loop = false;
 			break;
 		case NODE_FOR:
 			check_for(s, node);
 			break;
 		case NODE_VAR_DECL:
-			t = get_type(s, node->expr.var_decl.type);
-			name = intern_string(s, node->expr.var_decl.name, node->expr.var_decl.name_len);
+			decl = &a->decls[a->data[node]];
+			t = get_type(s, decl->type);
+			name = decl->symbol;
 			if (get_def(s, name)) {
-				error(node, "redeclaration of variable.");
+				error(s, node, "redeclaration of variable.");
 				break;
 			}
-			if (!can_cast(get_expression_type(s, node->expr.var_decl.value), t) && !match(t, get_expression_type(s, node->expr.var_decl.value))) {
-				error(node, "type mismatch.");
+			value = get_expression_type(s, decl->value);
+			if (!can_cast(value, t) && !match(t, value)) {
+				error(s, node, "type mismatch.");
 			}
-			shput(current_scope->defs, name, t);
+			define(s, name, t);
 			break;
 		default:
 			get_expression_type(s, node);
@@ -632,93 +801,246 @@ static void check_statement(sema *s, ast_node *node)
 	}
 }
 
-static void check_function(sema *s, ast_node *f)
+static void check_function(sema *s, node_id f)
 {
+	ast *a = s->ast;
+	node_id body = parser_body(s->parser, f);
+	ast_function *fn = &a->functions[a->data[f]];
 	push_scope(s);
-	current_return = get_type(s, f->expr.function.type);
+	s->current_return = get_type(s, fn->type);
 
-	member *param = f->expr.function.parameters;
+	u32 param = fn->params;
 	while (param) {
-		type *p_type = get_type(s, param->type);
-		char *t_name = intern_string(s, param->name, param->name_len);
-		shput(current_scope->defs, t_name, p_type);
-		param = param->next;
+		type *p_type = get_type(s, a->members[param].type);
+		define(s, a->members[param].symbol, p_type);
+		param = a->members[param].next;
 	}
 
-	ast_node *current = f->expr.function.body;
-	while (current && current->type == NODE_UNIT) {
-		check_statement(s, current->expr.unit_node.expr);
-		current = current->expr.unit_node.next;
+	ast_list list = body ? a->lists[a->data[body]] : (ast_list){ 0 };
+	for (u32 i=0; i < list.len; i++) {
+		check_statement(s, a->children[list.start + i]);
 	}
 
 	pop_scope(s);
 }
 
-static void analyze_unit(sema *s, ast_node *node)
+/* Functions with less source than this are not worth a thread. */
+#define PART_MIN (1 << 18)
+
+typedef struct {
+	/* A copy of the context with its own scopes and errors. */
+	sema s;
+	/* The functions [first, end) of the unit, and their offsets. */
+	node_id *functions;
+	u32 *bases;
+	usize first, end;
+	pthread_t thread;
+	bool spawned;
+} part;
+
+static void *check_part(void *arg)
 {
-	ast_node *current = node;
-	while (current && current->type == NODE_UNIT) {
-		order_type(s, current->expr.unit_node.expr);
-		current = current->expr.unit_node.next;
+	part *w = arg;
+	for (usize i = w->first; i < w->end; i++) {
+		w->s.base = w->bases[i];
+		check_function(&w->s, w->functions[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Check the functions on `threads` threads, each one a run of functions
+ * with about the same amount of source. The errors are printed once all
+ * are done, in the order of the functions.
+ */
+static void check_parallel(sema *s, node_id *functions, u32 *bases, usize threads)
+{
+	usize count = arrlen(functions);
+	u32 first = bases[0];
+	usize size = s->lexer->size - first;
+	usize n = size / PART_MIN;
+	if (n > threads) n = threads;
+	if (n > count) n = count;
+	if (n < 2) {
+		for (usize i = 0; i < count; i++) {
+			s->base = bases[i];
+			check_function(s, functions[i]);
+		}
+		return;
+	}
+
+	part *parts = malloc(n * sizeof(part));
+	usize i = 0;
+	for (usize k = 0; k < n; k++) {
+		part *w = &parts[k];
+		w->s = *s;
+		w->s.bindings = NULL;
+		w->s.scopes = NULL;
+		w->s.visible = NULL;
+		w->s.shapes = NULL;
+		arrsetlen(w->s.visible, arrlen(s->visible));
+		memset(w->s.visible, 0x0, arrlen(s->visible) * sizeof(type *));
+		w->s.errors = NULL;
+		w->s.deferred = true;
+		w->functions = functions;
+		w->bases = bases;
+		w->first = i;
+		/* Up to the first function past the share of the part. */
+		usize target = first + size * (k + 1) / n;
+		while (i < count && (k == n - 1 || bases[i] < target)) i++;
+		w->end = i;
+	}
+
+	for (usize k = 1; k < n; k++) {
+		parts[k].spawned = pthread_create(&parts[k].thread, NULL, check_part, &parts[k]) == 0;
+		if (!parts[k].spawned) check_part(&parts[k]);
+	}
+	check_part(&parts[0]);
+	for (usize k = 0; k < n; k++) {
+		if (k > 0 && parts[k].spawned) pthread_join(parts[k].thread, NULL);
+		sema *w = &parts[k].s;
+		for (usize e = 0; e < arrlen(w->errors); e++) {
+			print_error(s, w->errors[e].node, w->errors[e].base, w->errors[e].message);
+		}
+		arrfree(w->errors);
+		arrfree(w->visible);
+		arrfree(w->scopes);
+		arrfree(w->bindings);
+		hmfree(w->shapes);
+	}
+	free(parts);
+}
+
+static void analyze_unit(sema *s, node_id node, usize threads)
+{
+	ast *a = s->ast;
+	ast_list unit = a->lists[a->data[node]];
+	node_id *decls = a->children + unit.start;
+	for (u32 i=0; i < unit.len; i++) {
+		s->base = a->bases[i];
+		order_type(s, decls[i]);
 	}
 
 	create_types(s);
 
-	current = node;
-	while (current && current->type == NODE_UNIT) {
-		if (current->expr.unit_node.expr->type == NODE_FUNCTION) {
-			create_prototype(s, current->expr.unit_node.expr);
+	for (u32 i=0; i < unit.len; i++) {
+		if (a->kinds[decls[i]] == NODE_FUNCTION) {
+			s->base = a->bases[i];
+			create_prototype(s, decls[i]);
 		}
-		current = current->expr.unit_node.next;
 	}
 
-	current = node;
-	while (current && current->type == NODE_UNIT) {
-		if (current->expr.unit_node.expr->type == NODE_FUNCTION) {
-			check_function(s, current->expr.unit_node.expr);
+	/*
+	 * Parse the lazy bodies first, the workers only read the AST. That
+	 * grows `children`, so don't keep `decls`.
+	 */
+	node_id *functions = NULL;
+	u32 *bases = NULL;
+	for (u32 i=0; i < unit.len; i++) {
+		node_id decl = a->children[unit.start + i];
+		if (a->kinds[decl] == NODE_FUNCTION) {
+			parser_body(s->parser, decl);
+			arrput(functions, decl);
+			arrput(bases, a->bases[i]);
 		}
-		current = current->expr.unit_node.next;
 	}
+	/* Every node belongs to one function, so the workers share it. */
+	s->expr_types = calloc(arrlen(a->kinds), sizeof(type *));
+	if (arrlen(functions) > 0) {
+		check_parallel(s, functions, bases, threads);
+	}
+	arrfree(functions);
+	arrfree(bases);
 }
 
-sema *sema_init(parser *p, arena *a)
+sema *sema_parallel(parser *p, arena *a, usize threads)
 {
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
 	sema *s = arena_alloc(a, sizeof(sema));
+	memset(s, 0x0, sizeof(sema));
 	s->allocator = a;
-	types = NULL;
+	s->lexer = p->lexer;
+	s->symbols = p->lexer->symbols;
+	s->shared = arena_alloc(a, sizeof(sema_context));
+	memset(s->shared, 0x0, sizeof(sema_context));
+	pthread_mutex_init(&s->shared->shapes_lock, NULL);
 	s->ast = p->ast;
-
-	global_scope = arena_alloc(a, sizeof(scope));
-	global_scope->parent = NULL;
-	global_scope->defs = NULL;
-	current_scope = global_scope;
-
-	register_type(s, "void", create_integer(s, "void", 0, false));
-	register_type(s, "bool", create_integer(s, "bool", 8, false));
-	register_type(s, "u8", create_integer(s, "u8", 8, false));
-	register_type(s, "u16", create_integer(s, "u16", 16, false));
-	register_type(s, "u32", create_integer(s, "u32", 32, false));
-	register_type(s, "u64", create_integer(s, "u64", 64, false));
-	register_type(s, "i8", create_integer(s, "i8", 8, true));
-	register_type(s, "i16", create_integer(s, "i16", 16, true));
-	register_type(s, "i32", create_integer(s, "i32", 32, true));
-	register_type(s, "i64", create_integer(s, "i64", 64, true));
-	register_type(s, "f32", create_float(s, "f32", 32));
-	register_type(s, "f64", create_float(s, "f64", 64));
-
-	const_int = arena_alloc(s->allocator, sizeof(type));
-	const_int->name = "const_int";
-	const_int->tag = TYPE_INTEGER_CONST;
-	const_int->data.integer = 0;
-
-	const_float = arena_alloc(s->allocator, sizeof(type));
-	const_float->name = "const_float";
-	const_float->tag = TYPE_FLOAT_CONST;
-	const_float->data.flt = 0;
-
-	analyze_unit(s, s->ast);
-
+	s->root = p->root;
+	s->parser = p;
+
+	register_type(s, create_integer(s, "void", 0, false));
+	register_type(s, create_integer(s, "bool", 8, false));
+	register_type(s, create_integer(s, "u8", 8, false));
+	register_type(s, create_integer(s, "u16", 16, false));
+	register_type(s, create_integer(s, "u32", 32, false));
+	register_type(s, create_integer(s, "u64", 64, false));
+	register_type(s, create_integer(s, "i8", 8, true));
+	register_type(s, create_integer(s, "i16", 16, true));
+	register_type(s, create_integer(s, "i32", 32, true));
+	register_type(s, create_integer(s, "i64", 64, true));
+	register_type(s, create_float(s, "f32", 32));
+	register_type(s, create_float(s, "f64", 64));
+	/* Looked up by `builtin()` while checking, the interner must not grow then. */
+	intern(s->symbols, "usize", strlen("usize"));
+
+	/* Every name of the source, `define()` grows it for the others. */
+	arrsetlen(s->visible, s->symbols->count);
+	memset(s->visible, 0x0, s->symbols->count * sizeof(type *));
+
+	s->shared->const_int = arena_alloc(s->allocator, sizeof(type));
+	s->shared->const_int->name = "const_int";
+	s->shared->const_int->tag = TYPE_INTEGER_CONST;
+	s->shared->const_int->data.integer = 0;
+
+	s->shared->const_float = arena_alloc(s->allocator, sizeof(type));
+	s->shared->const_float->name = "const_float";
+	s->shared->const_float->tag = TYPE_FLOAT_CONST;
+	s->shared->const_float->data.flt = 0;
+
+	analyze_unit(s, s->root, threads);
+
+	arrfree(s->visible);
+	arrfree(s->scopes);
+	arrfree(s->bindings);
+	hmfree(s->shapes);
 	return s;
 }
 
+sema *sema_init(parser *p, arena *a)
+{
+	return sema_parallel(p, a, 1);
+}
+
+type *sema_type(sema *s, node_id node)
+{
+	type *t = s->expr_types ? s->expr_types[node] : NULL;
+	return t == &untyped ? NULL : t;
+}
 
+void sema_deinit(sema *s)
+{
+	sema_context *c = s->shared;
+	for (usize i = 0; i < hmlen(c->types); i++) {
+		arrfree(c->types[i].value->node.out);
+	}
+	for (usize i = 0; i < hmlen(c->type_reg); i++) {
+		type *t = c->type_reg[i].value;
+		if (t->tag == TYPE_STRUCT || t->tag == TYPE_UNION) {
+			hmfree(t->data.structure.member_types);
+		}
+	}
+	for (usize i = 0; i < hmlen(c->prototypes); i++) {
+		arrfree(c->prototypes[i].value->parameters);
+	}
+	hmfree(c->types);
+	hmfree(c->type_reg);
+	hmfree(c->prototypes);
+	hmfree(c->shapes);
+	pthread_mutex_destroy(&c->shapes_lock);
+	free(s->expr_types);
+	s->expr_types = NULL;
+}
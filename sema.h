@@ -3,7 +3,6 @@
 
 #include <stdbool.h>
 #include "parser.h"
-#include "stb_ds.h"
 #include "utils.h"
 
 typedef enum {
@@ -27,6 +26,7 @@ typedef struct _type {
 	usize size;
 	usize alignment;
 	char *name;
+	u32 symbol;
 	union {
 		u8 integer;
 		u8 flt; // float
@@ -42,35 +42,87 @@ typedef struct _type {
 			struct _type *child;
 		} slice;
 		struct {
-			char *name;
-			usize name_len;
-			member *members;
-			struct { char *key; struct _type *value; } *member_types;
+			/* First entry of the AST `members`. */
+			u32 members;
+			struct { u32 key; struct _type *value; } *member_types;
 		} structure;
 		struct {
-			char *name;
-			usize name_len;
-			variant *variants;
+			/* First entry of the AST `variants`. */
+			u32 variants;
 		} enm; /* TODO */
 	} data;
 } type;
 
 typedef struct {
 	char *name;
+	u32 symbol;
 	type *type;
 	type **parameters;
 } prototype;
 
-typedef struct _scope {
-	struct _scope *parent;
-	struct { char *key; type *value; } *defs;
-} scope;
+/* A declaration, and the one of the same name it hides until its scope ends. */
+typedef struct {
+	u32 symbol;
+	type *shadowed;
+} binding;
+
+/* The tables of the named types, prototypes and pointer types. */
+typedef struct sema_context sema_context;
+struct shape_entry;
+
+/* An error found by a worker, see `sema_parallel()`. */
+typedef struct {
+	node_id node;
+	/* Offset of the declaration of `node`. */
+	u32 base;
+	char *message;
+} sema_error;
 
+/*
+ * The state of the checker of function bodies: every thread has its own
+ * copy, and they share `shared` which is only read once the types and
+ * the prototypes are created.
+ */
 typedef struct {
 	arena *allocator;
-	ast_node *ast;
+	lexer *lexer;
+	interner *symbols;
+	ast *ast;
+	node_id root;
+	sema_context *shared;
+	/* To parse the function bodies skipped by `parser_lazy()`. */
+	parser *parser;
+	/* Declarations of the open scopes, the innermost last. */
+	binding *bindings;
+	/* Where every open scope starts in `bindings`. */
+	usize *scopes;
+	/* The innermost declaration of every symbol, indexed by symbol. */
+	type **visible;
+	/* The pointer and slice types this thread used, see `intern_type()`. */
+	struct shape_entry *shapes;
+	/* Offset of the declaration being checked, see `bases` in `ast`. */
+	u32 base;
+	type *current_return;
+	bool in_loop;
+	/* Keep the errors in `errors` instead of printing them. */
+	bool deferred;
+	sema_error *errors;
+	/* Type of every expression node, see `sema_type()`. */
+	type **expr_types;
 } sema;
 
 sema *sema_init(parser *p, arena *a);
+/*
+ * Like `sema_init()`, but once the types and the prototypes are created
+ * the function bodies are checked on `threads` threads, or one per CPU
+ * when it is 0. The errors are printed in the same order.
+ */
+sema *sema_parallel(parser *p, arena *a, usize threads);
+/*
+ * Type of the expression `node`, as checked. NULL for the nodes that
+ * are not expressions or have no valid type.
+ */
+type *sema_type(sema *s, node_id node);
+void sema_deinit(sema *s);
 
 #endif
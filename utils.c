@@ -3,6 +3,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static u64 digit_value(char c)
+{
+	if (c <= '9') return c - '0';
+	return (c | 0x20) - 'a' + 10;
+}
 
 i64 parse_int(char *s, usize len)
 {
@@ -13,9 +24,17 @@ i64 parse_int(char *s, usize len)
 		negative = true;
 	}
 
+	u64 base = 10;
+	if (len > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'b' || s[1] == 'o')) {
+		base = s[1] == 'x' ? 16 : s[1] == 'b' ? 2 : 8;
+		s += 2;
+		len -= 2;
+	}
+
 	u64 int_part = 0;
 	for (usize i=0; i < len; i++) {
-		int_part = (int_part * 10) + (s[i] - '0');
+		if (s[i] == '_') continue;
+		int_part = int_part * base + digit_value(s[i]);
 	}
 
 	if (negative) {
@@ -25,6 +44,102 @@ i64 parse_int(char *s, usize len)
 	return int_part;
 }
 
+typedef struct {
+	u64 high, low;
+} u128;
+
+static u128 multiply(u64 a, u64 b)
+{
+#ifdef __SIZEOF_INT128__
+	__extension__ unsigned __int128 r = (unsigned __int128)a * b;
+	return (u128){ r >> 64, (u64)r };
+#else
+	u64 a0 = (u32)a, a1 = a >> 32, b0 = (u32)b, b1 = b >> 32;
+	u64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	u64 mid = (p00 >> 32) + (u32)p01 + (u32)p10;
+	return (u128){ p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32), (mid << 32) | (u32)p00 };
+#endif
+}
+
+#include "pow5.h"
+
+/*
+ * Eisel-Lemire: round w * 10^q to the nearest double using a 128 bit
+ * approximation of 5^q. Returns false when the approximation is too
+ * close to a halfway point to decide, or for subnormals, in which case
+ * the caller falls back to `strtod()`.
+ */
+static bool eisel_lemire(u64 w, i64 q, f64 *out)
+{
+	if (w == 0 || q < POW5_MIN) {
+		*out = 0.0;
+		return true;
+	}
+	if (q > POW5_MAX) {
+		*out = HUGE_VAL;
+		return true;
+	}
+
+	int lz = __builtin_clzll(w);
+	w <<= lz;
+	const u64 *p = pow5[q - POW5_MIN];
+	u128 product = multiply(w, p[0]);
+	/* 9 = 64 bits - 52 mantissa bits - 3 bits of rounding slack. */
+	if ((product.high & 0x1ff) == 0x1ff) {
+		u128 low = multiply(w, p[1]);
+		product.low += low.high;
+		if (low.high > product.low) product.high += 1;
+	}
+	/* Outside of this range the 128 bits of 5^q might not be enough. */
+	if (product.low == ~(u64)0 && (q < -27 || q > 55)) {
+		return false;
+	}
+
+	int upper = product.high >> 63;
+	int shift = upper + 9;
+	u64 mantissa = product.high >> shift;
+	/* floor(q * log2(10)) + 63, plus the exponent bias. */
+	i64 power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz + 1023;
+	if (power2 <= 0) {
+		return false;
+	}
+
+	/* Exactly halfway: round to even instead of up. */
+	if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+			&& (mantissa << shift) == product.high) {
+		mantissa &= ~(u64)1;
+	}
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if (mantissa >= (u64)2 << 52) {
+		mantissa = (u64)1 << 52;
+		power2 += 1;
+	}
+	mantissa &= ~((u64)1 << 52);
+	if (power2 >= 0x7ff) {
+		*out = HUGE_VAL;
+		return true;
+	}
+
+	u64 bits = mantissa | (u64)power2 << 52;
+	memcpy(out, &bits, sizeof(bits));
+	return true;
+}
+
+/* Powers of ten that are exact in a double. */
+static const f64 exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * Decimal floats with `_` separators and an optional exponent. The
+ * first 19 significant digits are gathered into an integer w, so the
+ * value is w * 10^q: when both fit in a double exactly a single
+ * multiplication or division is correctly rounded (Clinger), else
+ * Eisel-Lemire handles almost everything, and literals it can't decide
+ * or with more digits are left to `strtod()`.
+ */
 f64 parse_float(char *s, usize len)
 {
 	bool negative = false;
@@ -34,28 +149,62 @@ f64 parse_float(char *s, usize len)
 		negative = true;
 	}
 
-	usize point_pos = 0;
-	for (usize i=0; i < len; i++) {
+	u64 w = 0;
+	i64 q = 0;
+	usize digits = 0;
+	bool truncated = false;
+	bool fraction = false;
+	usize i = 0;
+	for (; i < len && s[i] != 'e' && s[i] != 'E'; i++) {
+		if (s[i] == '_') continue;
 		if (s[i] == '.') {
-			point_pos = i;
-			break;
+			fraction = true;
+			continue;
+		}
+		if (digits == 0 && s[i] == '0') {
+			if (fraction) q -= 1;
+			continue;
+		}
+		if (digits < 19) {
+			w = w * 10 + (s[i] - '0');
+			digits += 1;
+			if (fraction) q -= 1;
+		} else {
+			truncated = true;
+			if (!fraction) q += 1;
 		}
 	}
 
-	i64 int_part = parse_int(s, point_pos);
-	i64 dec_part = parse_int(s+point_pos+1, len-point_pos-1);
-	for (usize i=0; i < len-point_pos-1; i++) {
-		int_part *= 10;
+	if (i < len) {
+		bool negative_exp = false;
+		i64 exp = 0;
+		i += 1;
+		if (s[i] == '+' || s[i] == '-') {
+			negative_exp = s[i] == '-';
+			i += 1;
+		}
+		for (; i < len; i++) {
+			if (s[i] == '_') continue;
+			/* Anything this large is already zero or infinity. */
+			if (exp < 100000) exp = exp * 10 + (s[i] - '0');
+		}
+		q += negative_exp ? -exp : exp;
 	}
 
-	int_part += dec_part;
-
-	f64 f = (f64) int_part;
-
-	point_pos += 1;
-
-	for (usize i=0; i < len - point_pos; i++) {
-		f /= 10.0;
+	f64 f;
+	if (!truncated && w <= (u64)1 << 53 && q >= -22 && q <= 22) {
+		f = (f64)w;
+		f = q < 0 ? f / exact_pow10[-q] : f * exact_pow10[q];
+	} else if (truncated || !eisel_lemire(w, q, &f)) {
+		char small[64];
+		char *buf = len < sizeof(small) ? small : malloc(len + 1);
+		usize n = 0;
+		for (usize j=0; j < len; j++) {
+			if (s[j] != '_') buf[n++] = s[j];
+		}
+		buf[n] = '\0';
+		f = strtod(buf, NULL);
+		if (buf != small) free(buf);
 	}
 
 	if (negative) {
@@ -110,6 +259,102 @@ static usize align_forward(usize ptr, usize align) {
 	return (usize)p;
 }
 
+interner *interner_init(arena *a)
+{
+	interner *in = arena_alloc(a, sizeof(interner));
+	in->allocator = a;
+	in->capacity = 1024;
+	in->slots = arena_alloc(a, in->capacity * sizeof(u32));
+	memset(in->slots, 0x0, in->capacity * sizeof(u32));
+	in->names_capacity = 512;
+	in->names = arena_alloc(a, in->names_capacity * sizeof(char *));
+	in->lengths = arena_alloc(a, in->names_capacity * sizeof(u32));
+	in->hashes = arena_alloc(a, in->names_capacity * sizeof(u32));
+	/* Symbol 0 is reserved. */
+	in->names[0] = "";
+	in->lengths[0] = 0;
+	in->hashes[0] = 0;
+	in->count = 1;
+	return in;
+}
+
+/* FNV-1a */
+static u32 hash_span(char *s, usize len)
+{
+	u32 h = 2166136261u;
+	for (usize i=0; i < len; i++) {
+		h = (h ^ (u8)s[i]) * 16777619u;
+	}
+	return h;
+}
+
+static void *arena_grow(arena *a, void *old, usize old_size, usize size)
+{
+	void *new = arena_alloc(a, size);
+	memcpy(new, old, old_size);
+	return new;
+}
+
+static void interner_rehash(interner *in)
+{
+	usize capacity = in->capacity * 2;
+	u32 *slots = arena_alloc(in->allocator, capacity * sizeof(u32));
+	memset(slots, 0x0, capacity * sizeof(u32));
+	for (u32 id=1; id < in->count; id++) {
+		usize i = in->hashes[id] & (capacity - 1);
+		while (slots[i]) i = (i + 1) & (capacity - 1);
+		slots[i] = id;
+	}
+	in->slots = slots;
+	in->capacity = capacity;
+}
+
+u32 intern(interner *in, char *s, usize len)
+{
+	u32 h = hash_span(s, len);
+	usize i = h & (in->capacity - 1);
+	while (in->slots[i]) {
+		u32 id = in->slots[i];
+		if (in->hashes[id] == h && in->lengths[id] == len && memcmp(in->names[id], s, len) == 0) {
+			return id;
+		}
+		i = (i + 1) & (in->capacity - 1);
+	}
+
+	if (in->count == in->names_capacity) {
+		usize old = in->names_capacity;
+		in->names_capacity *= 2;
+		in->names = arena_grow(in->allocator, in->names, old * sizeof(char *), in->names_capacity * sizeof(char *));
+		in->lengths = arena_grow(in->allocator, in->lengths, old * sizeof(u32), in->names_capacity * sizeof(u32));
+		in->hashes = arena_grow(in->allocator, in->hashes, old * sizeof(u32), in->names_capacity * sizeof(u32));
+	}
+
+	u32 id = in->count++;
+	char *name = arena_alloc(in->allocator, len + 1);
+	memcpy(name, s, len);
+	name[len] = '\0';
+	in->names[id] = name;
+	in->lengths[id] = len;
+	in->hashes[id] = h;
+	in->slots[i] = id;
+
+	if (in->count * 2 > in->capacity) {
+		interner_rehash(in);
+	}
+
+	return id;
+}
+
+char *symbol_name(interner *in, u32 symbol)
+{
+	return in->names[symbol];
+}
+
+usize symbol_len(interner *in, u32 symbol)
+{
+	return in->lengths[symbol];
+}
+
 arena arena_init(usize size)
 {
 	return (arena){
@@ -148,3 +393,49 @@ void arena_deinit(arena a)
 {
 	free(a.memory);
 }
+
+source_file source_open(char *path)
+{
+	source_file f = { .data = NULL, .size = 0, .mapped = 0 };
+	struct stat st;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return f;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return f;
+	}
+
+	usize page = sysconf(_SC_PAGESIZE);
+	usize size = st.st_size;
+	usize mapped = align_forward(size, page) + page;
+
+	/*
+	 * Reserve the whole range with zero pages first, then map the file
+	 * over its beginning. The tail of the last file page is zero filled
+	 * by the kernel and the extra page covers files whose size is a
+	 * multiple of the page size.
+	 */
+	char *data = mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return f;
+	}
+
+	if (size > 0 && mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(data, mapped);
+		close(fd);
+		return f;
+	}
+	close(fd);
+
+	f.data = data;
+	f.size = size;
+	f.mapped = mapped;
+	return f;
+}
+
+void source_close(source_file f)
+{
+	if (f.data) munmap(f.data, f.mapped);
+}
@@ -57,8 +57,45 @@ typedef struct _trie_node {
 void trie_insert(trie_node *root, arena *a, char *key, uint16_t value);
 uint16_t trie_get(trie_node *root, char *key, usize len);
 
+/*
+ * Maps byte spans to dense symbol ids, every distinct span gets the next
+ * id starting from 1 (0 is never a valid symbol). Names are copied once
+ * in the arena and NUL terminated, and so is the open addressing table,
+ * which is reallocated in the arena when it gets half full.
+ */
+typedef struct {
+	arena *allocator;
+	u32 *slots;
+	usize capacity;
+	char **names;
+	u32 *lengths;
+	u32 *hashes;
+	u32 count;
+	u32 names_capacity;
+} interner;
+
+interner *interner_init(arena *a);
+u32 intern(interner *in, char *s, usize len);
+char *symbol_name(interner *in, u32 symbol);
+usize symbol_len(interner *in, u32 symbol);
+
 typedef struct {
 	usize row, column;
 } source_pos;
 
+typedef struct {
+	char *data;
+	usize size;
+	usize mapped;
+} source_file;
+
+/*
+ * Map a source file read-only. The mapping is followed by at least one
+ * zeroed page, so `data[size]` is always a readable `\0` sentinel and the
+ * lexer can work straight on the page cache without copying the file.
+ * On failure `data` is null.
+ */
+source_file source_open(char *path);
+void source_close(source_file f);
+
 #endif